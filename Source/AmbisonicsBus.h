@@ -0,0 +1,406 @@
+/*==============================================================================
+//                      Ambisonics Bus
+//      Sources are encoded into a shared spherical harmonic bus and the bus is
+//      decoded to binaural once per block
+//==============================================================================
+// - Channels are ACN ordered with SN3D normalisation, orders 1 to 3.
+// - The decoder filters are a least squares fit of the measured HRIRs onto the
+//   spherical harmonics, so decoding an encoded source at a measured direction
+//   approximates that HRIR as closely as the order allows.
+// - The decode cost only depends on the order, not on the number of sources.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "BinauralConvolver.h"
+
+//==============================================================================
+//              Spherical Harmonics
+//
+//==============================================================================
+
+namespace SphericalHarmonics {
+    static constexpr int maxOrder = 3;
+    static constexpr int maxChannels = (maxOrder + 1) * (maxOrder + 1);
+
+    inline int getNumChannels(int order) { return (order + 1) * (order + 1); }
+
+    /*=================================================================================*/
+
+    //Real SH gains for one direction in degrees, same angles as the HRTF planes
+    inline void evaluate(int order, float azimuth, float elevation, float *coefficients) {
+        const float az = degreesToRadians(azimuth);
+        const float el = degreesToRadians(elevation);
+        const float x = std::cos(az) * std::cos(el);
+        const float y = std::sin(az) * std::cos(el);
+        const float z = std::sin(el);
+
+        coefficients[0] = 1.0f;
+        if (order < 1)
+            return;
+
+        coefficients[1] = y;
+        coefficients[2] = z;
+        coefficients[3] = x;
+        if (order < 2)
+            return;
+
+        const float sqrt3 = std::sqrt(3.0f);
+        coefficients[4] = sqrt3 * x * y;
+        coefficients[5] = sqrt3 * y * z;
+        coefficients[6] = 0.5f * (3.0f * z * z - 1.0f);
+        coefficients[7] = sqrt3 * x * z;
+        coefficients[8] = 0.5f * sqrt3 * (x * x - y * y);
+        if (order < 3)
+            return;
+
+        const float c9 = std::sqrt(5.0f / 8.0f);
+        const float c11 = std::sqrt(3.0f / 8.0f);
+        const float sqrt15 = std::sqrt(15.0f);
+        coefficients[9] = c9 * y * (3.0f * x * x - y * y);
+        coefficients[10] = sqrt15 * x * y * z;
+        coefficients[11] = c11 * y * (5.0f * z * z - 1.0f);
+        coefficients[12] = 0.5f * z * (5.0f * z * z - 3.0f);
+        coefficients[13] = c11 * x * (5.0f * z * z - 1.0f);
+        coefficients[14] = 0.5f * sqrt15 * z * (x * x - y * y);
+        coefficients[15] = c9 * x * (x * x - 3.0f * y * y);
+    }
+}
+
+//==============================================================================
+//              Ambisonic Encoder
+//              Per source gain vector, ramped over the block when the source moves
+//==============================================================================
+
+class AmbisonicEncoder {
+public:
+    AmbisonicEncoder() {}
+
+    /*=================================================================================*/
+
+    void reset() { running = false; }
+
+    /*=================================================================================*/
+
+    //The gains glide to the new direction over the next encoded block
+    void setDirection(int order, float azimuth, float elevation, float gain) {
+        numChannels = SphericalHarmonics::getNumChannels(order);
+        SphericalHarmonics::evaluate(order, azimuth, elevation, target);
+        FloatVectorOperations::multiply(target, gain, numChannels);
+
+        if (!running)
+            FloatVectorOperations::copy(current, target, numChannels);
+    }
+
+    /*=================================================================================*/
+
+    //Adds the input to the first numChannels channels of the bus
+    void encode(const float *input, AudioSampleBuffer &bus, int startSample, int numSamples) {
+        jassert(bus.getNumChannels() >= numChannels);
+        running = true;
+
+        for (int channel = 0; channel < numChannels; ++channel) {
+            float *dest = bus.getWritePointer(channel, startSample);
+            const float start = current[channel];
+            const float step = (target[channel] - start) / (float) numSamples;
+
+            if (step == 0.0f) {
+                FloatVectorOperations::addWithMultiply(dest, input, start, numSamples);
+            } else {
+                for (int i = 0; i < numSamples; ++i)
+                    dest[i] += input[i] * (start + step * (float) (i + 1));
+            }
+        }
+        FloatVectorOperations::copy(current, target, numChannels);
+    }
+
+private:
+    float current[SphericalHarmonics::maxChannels] = {};
+    float target[SphericalHarmonics::maxChannels] = {};
+    int numChannels = 1;
+    bool running = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AmbisonicEncoder)
+};
+
+//==============================================================================
+//              Ambisonic Decoder
+//              SH domain HRIR filters, one delay line per bus channel
+//==============================================================================
+
+class AmbisonicDecoder {
+public:
+    //Tikhonov weight relative to the mean diagonal, keeps the barely sampled vertical
+    //harmonics from blowing up with the three near horizontal planes
+    static constexpr double regularisation = 1.0e-3;
+
+    AmbisonicDecoder() {}
+
+    /*=================================================================================*/
+
+    void clearDirections(int newImpulseLength) {
+        impulseLength = newImpulseLength;
+        directions.clear();
+        impulses.clear();
+    }
+
+    /*=================================================================================*/
+
+    //Copies one measured HRIR pair, the fit happens in prepare
+    void addDirection(float azimuth, float elevation, const float *irLeft, const float *irRight) {
+        directions.push_back(azimuth);
+        directions.push_back(elevation);
+        impulses.insert(impulses.end(), irLeft, irLeft + impulseLength);
+        impulses.insert(impulses.end(), irRight, irRight + impulseLength);
+    }
+
+    int getNumDirections() const { return (int) directions.size() / 2; }
+
+    /*=================================================================================*/
+
+    //Fits the SH filters for this order and allocates the bus and delay lines
+    void prepare(int newOrder, int partitionSize, int maxBlockSize) {
+        jassert(getNumDirections() > 0);
+        order = jlimit(1, SphericalHarmonics::maxOrder, newOrder);
+        numChannels = SphericalHarmonics::getNumChannels(order);
+
+        std::vector<float> filters;
+        fitFilters(filters);
+
+        bank.setPartitionSize(partitionSize, impulseLength);
+        for (int channel = 0; channel < numChannels; ++channel) {
+            auto *filter = filters.data() + (size_t) channel * 2 * impulseLength;
+            bank.addImpulse(filter, filter + impulseLength, impulseLength);
+        }
+
+        auto segmentStride = bank.getSegmentStride();
+        numSlots = bank.getNumSegments();
+
+        delayLines.resize((size_t) numChannels);
+        inputBlocks.resize((size_t) numChannels);
+        for (int channel = 0; channel < numChannels; ++channel) {
+            delayLines[(size_t) channel].assign((size_t) (segmentStride * numSlots), 0.0f);
+            inputBlocks[(size_t) channel].assign((size_t) partitionSize, 0.0f);
+        }
+        for (int ear = 0; ear < 2; ++ear) {
+            accumulator[ear].assign((size_t) segmentStride, 0.0f);
+            history[ear].assign((size_t) segmentStride, 0.0f);
+            overlap[ear].assign((size_t) partitionSize, 0.0f);
+        }
+        fftBuffer.assign((size_t) bank.getFFTSize() * 2, 0.0f);
+        bus.setSize(numChannels, maxBlockSize);
+
+        reset();
+    }
+
+    /*=================================================================================*/
+
+    void reset() {
+        for (auto &line : delayLines)
+            std::fill(line.begin(), line.end(), 0.0f);
+        for (auto &block : inputBlocks)
+            std::fill(block.begin(), block.end(), 0.0f);
+        for (auto &ear : overlap)
+            std::fill(ear.begin(), ear.end(), 0.0f);
+        bus.clear();
+        inputPos = 0;
+        currentSegment = 0;
+    }
+
+    /*=================================================================================*/
+
+    int getOrder() const { return order; }
+
+    int getNumChannels() const { return numChannels; }
+
+    //Encoders write here between clearBus and decode, at most getMaxBlockSize samples
+    AudioSampleBuffer &getBus() { return bus; }
+
+    int getMaxBlockSize() const { return bus.getNumSamples(); }
+
+    void clearBus(int numSamples) { bus.clear(0, numSamples); }
+
+    /*=================================================================================*/
+
+    //Adds the binaural decode of the first numSamples of the bus to the outputs
+    void decode(float *outputLeft, float *outputRight, int numSamples) {
+        jassert(numSamples <= bus.getNumSamples());
+
+        float *outputs[2] = {outputLeft, outputRight};
+        auto partitionSize = bank.getPartitionSize();
+        int processed = 0;
+
+        while (processed < numSamples) {
+            const bool newBlock = (inputPos == 0);
+            const int num = jmin(numSamples - processed, partitionSize - inputPos);
+
+            for (int channel = 0; channel < numChannels; ++channel) {
+                FloatVectorOperations::copy(inputBlocks[(size_t) channel].data() + inputPos,
+                                            bus.getReadPointer(channel, processed), num);
+                transformInput(channel);
+            }
+
+            //Every channel's older segments, summed once per partition
+            if (newBlock)
+                for (int ear = 0; ear < 2; ++ear)
+                    accumulate(ear, 1, history[ear].data());
+
+            for (int ear = 0; ear < 2; ++ear) {
+                auto &acc = accumulator[ear];
+                FloatVectorOperations::copy(acc.data(), history[ear].data(), bank.getSegmentStride());
+                for (int channel = 0; channel < numChannels; ++channel)
+                    HRTFSpectrumBank::multiplyAccumulate(acc.data(), getInputSegment(channel, 0),
+                                                         bank.getSegment(channel, ear, 0), bank.getNumBins());
+
+                HRTFSpectrumBank::splitToSymmetric(acc.data(), fftBuffer.data(), bank.getNumBins(), bank.getFFTSize());
+                bank.getFFT().performRealOnlyInverseTransform(fftBuffer.data());
+
+                float *out = outputs[ear] + processed;
+                FloatVectorOperations::add(out, fftBuffer.data() + inputPos, num);
+                FloatVectorOperations::add(out, overlap[ear].data() + inputPos, num);
+
+                if (inputPos + num == partitionSize)
+                    FloatVectorOperations::copy(overlap[ear].data(), fftBuffer.data() + partitionSize, partitionSize);
+            }
+
+            inputPos += num;
+            processed += num;
+
+            if (inputPos == partitionSize) {
+                inputPos = 0;
+                currentSegment = (currentSegment + numSlots - 1) % numSlots;
+                for (auto &block : inputBlocks)
+                    std::fill(block.begin(), block.end(), 0.0f);
+            }
+        }
+    }
+
+private:
+    /*=================================================================================*/
+
+    //filters = (Y'Y + lambda I)^-1 Y' H, channel major with left then right
+    void fitFilters(std::vector<float> &filters) const {
+        const int numDirections = getNumDirections();
+        std::vector<double> sh((size_t) numDirections * numChannels);
+        float coefficients[SphericalHarmonics::maxChannels];
+
+        for (int n = 0; n < numDirections; ++n) {
+            SphericalHarmonics::evaluate(order, directions[(size_t) n * 2], directions[(size_t) n * 2 + 1],
+                                         coefficients);
+            for (int c = 0; c < numChannels; ++c)
+                sh[(size_t) (n * numChannels + c)] = coefficients[c];
+        }
+
+        //Normal equations, right hand side is Y' so solving gives the decode weights
+        std::vector<double> gram((size_t) numChannels * numChannels, 0.0);
+        std::vector<double> weights((size_t) numChannels * numDirections, 0.0);
+        for (int n = 0; n < numDirections; ++n)
+            for (int i = 0; i < numChannels; ++i) {
+                const double yi = sh[(size_t) (n * numChannels + i)];
+                weights[(size_t) (i * numDirections + n)] = yi;
+                for (int j = 0; j < numChannels; ++j)
+                    gram[(size_t) (i * numChannels + j)] += yi * sh[(size_t) (n * numChannels + j)];
+            }
+
+        double trace = 0;
+        for (int i = 0; i < numChannels; ++i)
+            trace += gram[(size_t) (i * numChannels + i)];
+        for (int i = 0; i < numChannels; ++i)
+            gram[(size_t) (i * numChannels + i)] += regularisation * trace / numChannels;
+
+        solve(gram, weights, numChannels, numDirections);
+
+        filters.assign((size_t) numChannels * 2 * impulseLength, 0.0f);
+        for (int c = 0; c < numChannels; ++c)
+            for (int n = 0; n < numDirections; ++n) {
+                auto weight = (float) weights[(size_t) (c * numDirections + n)];
+                for (int ear = 0; ear < 2; ++ear)
+                    FloatVectorOperations::addWithMultiply(
+                            filters.data() + (size_t) (c * 2 + ear) * impulseLength,
+                            impulses.data() + (size_t) (n * 2 + ear) * impulseLength, weight, impulseLength);
+            }
+    }
+
+    /*=================================================================================*/
+
+    //Gauss-Jordan with partial pivoting, a is size x size and b is size x columns, b gets the result
+    static void solve(std::vector<double> &a, std::vector<double> &b, int size, int columns) {
+        for (int col = 0; col < size; ++col) {
+            int pivot = col;
+            for (int row = col + 1; row < size; ++row)
+                if (std::abs(a[(size_t) (row * size + col)]) > std::abs(a[(size_t) (pivot * size + col)]))
+                    pivot = row;
+
+            if (pivot != col) {
+                std::swap_ranges(a.begin() + pivot * size, a.begin() + (pivot + 1) * size, a.begin() + col * size);
+                std::swap_ranges(b.begin() + pivot * columns, b.begin() + (pivot + 1) * columns,
+                                 b.begin() + col * columns);
+            }
+
+            const double scale = 1.0 / a[(size_t) (col * size + col)];
+            for (int j = 0; j < size; ++j)
+                a[(size_t) (col * size + j)] *= scale;
+            for (int j = 0; j < columns; ++j)
+                b[(size_t) (col * columns + j)] *= scale;
+
+            for (int row = 0; row < size; ++row) {
+                const double factor = a[(size_t) (row * size + col)];
+                if (row == col || factor == 0.0)
+                    continue;
+                for (int j = 0; j < size; ++j)
+                    a[(size_t) (row * size + j)] -= factor * a[(size_t) (col * size + j)];
+                for (int j = 0; j < columns; ++j)
+                    b[(size_t) (row * columns + j)] -= factor * b[(size_t) (col * columns + j)];
+            }
+        }
+    }
+
+    /*=================================================================================*/
+
+    const float *getInputSegment(int channel, int age) const {
+        auto slot = (currentSegment + age) % numSlots;
+        return delayLines[(size_t) channel].data() + (size_t) slot * bank.getSegmentStride();
+    }
+
+    /*=================================================================================*/
+
+    void transformInput(int channel) {
+        auto *head = delayLines[(size_t) channel].data() + (size_t) currentSegment * bank.getSegmentStride();
+        bank.transformBlock(inputBlocks[(size_t) channel].data(), fftBuffer.data(), head);
+    }
+
+    /*=================================================================================*/
+
+    void accumulate(int ear, int firstSegment, float *dest) const {
+        std::fill(dest, dest + bank.getSegmentStride(), 0.0f);
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            for (int segment = firstSegment; segment < bank.getNumSegments(channel); ++segment)
+                HRTFSpectrumBank::multiplyAccumulate(dest, getInputSegment(channel, segment),
+                                                     bank.getSegment(channel, ear, segment), bank.getNumBins());
+    }
+
+    /*=================================================================================*/
+
+    int impulseLength = 0;
+    int order = 1;
+    int numChannels = 4;
+    int numSlots = 1;
+    int inputPos = 0;
+    int currentSegment = 0;
+
+    std::vector<float> directions;
+    std::vector<float> impulses;
+    HRTFSpectrumBank bank;
+    AudioSampleBuffer bus;
+
+    std::vector<std::vector<float>> delayLines;
+    std::vector<std::vector<float>> inputBlocks;
+    std::vector<float> accumulator[2];
+    std::vector<float> history[2];
+    std::vector<float> overlap[2];
+    std::vector<float> fftBuffer;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AmbisonicDecoder)
+};
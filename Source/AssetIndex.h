@@ -0,0 +1,110 @@
+/*==============================================================================
+//                      Asset Index
+//      Every file under Resources, found once and mapped where possible
+//==============================================================================
+// - The Resources directory is located and scanned once at startup, lookups
+//   are by path relative to it ("subject48/0azleft.wav").
+// - Uncompressed WAVs are memory mapped. Nothing is read until a page is
+//   touched, the OS shares the pages between processes and can drop cold ones.
+// - Other formats fall back to a normal reader from the format manager.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+//              Asset Index
+//
+//==============================================================================
+
+class AssetIndex {
+public:
+    AssetIndex() {}
+
+    /*=================================================================================*/
+
+    //Walks up from the working directory like the loaders used to, then indexes every file
+    //below Resources. Not real-time safe.
+    bool build(AudioFormatManager &formatManager) {
+        formats = &formatManager;
+        assets.clear();
+        numMapped = 0;
+
+        directory = File::getCurrentWorkingDirectory();
+        for (int numTries = 0; !directory.getChildFile("Resources").exists() && numTries < 15; ++numTries)
+            directory = directory.getParentDirectory();
+        directory = directory.getChildFile("Resources");
+
+        if (!directory.isDirectory())
+            return false;
+
+        for (DirectoryIterator it(directory, true, "*", File::findFiles); it.next();) {
+            auto file = it.getFile();
+            auto &asset = assets[file.getRelativePathFrom(directory).replaceCharacter('\\', '/')];
+            asset.file = file;
+
+            if (file.hasFileExtension("wav")) {
+                asset.mapped.reset(wavFormat.createMemoryMappedReader(file));
+                if (asset.mapped != nullptr && asset.mapped->mapEntireFile())
+                    ++numMapped;
+                else
+                    asset.mapped.reset();
+            }
+        }
+        return true;
+    }
+
+    /*=================================================================================*/
+
+    //A non existent file when the asset is not indexed
+    File getFile(const String &name) const {
+        auto it = assets.find(name);
+        return it != assets.end() ? it->second.file : directory.getChildFile(name);
+    }
+
+    //Shared mapped reader, only for the thread that renders the scene. Null if the asset is
+    //missing or is not an uncompressed WAV.
+    MemoryMappedAudioFormatReader *getMapped(const String &name) const {
+        auto it = assets.find(name);
+        return it != assets.end() ? it->second.mapped.get() : nullptr;
+    }
+
+    /*=================================================================================*/
+
+    //New reader owned by the caller, mapped when the asset is, so it is safe on any thread
+    std::unique_ptr<AudioFormatReader> createReader(const String &name) const {
+        auto it = assets.find(name);
+        if (it == assets.end() || formats == nullptr)
+            return nullptr;
+
+        if (it->second.mapped != nullptr) {
+            std::unique_ptr<MemoryMappedAudioFormatReader> mapped(wavFormat.createMemoryMappedReader(it->second.file));
+            if (mapped != nullptr && mapped->mapEntireFile())
+                return std::unique_ptr<AudioFormatReader>(mapped.release());
+        }
+        return std::unique_ptr<AudioFormatReader>(formats->createReaderFor(it->second.file));
+    }
+
+    /*=================================================================================*/
+
+    const File &getDirectory() const { return directory; }
+
+    int size() const { return (int) assets.size(); }
+
+    int getNumMapped() const { return numMapped; }
+
+private:
+    struct Asset {
+        File file;
+        std::unique_ptr<MemoryMappedAudioFormatReader> mapped;
+    };
+
+    File directory;
+    AudioFormatManager *formats = nullptr;
+    mutable WavAudioFormat wavFormat;
+    std::map<String, Asset> assets;
+    int numMapped = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AssetIndex)
+};
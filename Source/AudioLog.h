@@ -0,0 +1,173 @@
+/*==============================================================================
+//                      Audio Log
+//      Diagnostics from the audio thread without touching a stream there
+//==============================================================================
+// - The audio thread pushes fixed size records: the message, a time stamp
+//   and up to four numbers. The push is wait-free and drops the record when
+//   the ring is full, counting what was dropped.
+// - A message is a static category and printf format whose placeholders
+//   all take doubles. Its address is its id, so nothing is formatted or
+//   copied on the audio thread.
+// - The writer thread formats the records and writes them to the console or
+//   a file. Each category has a rate limit per second, the excess is only
+//   counted and reported once the second is over.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SceneState.h"
+
+//==============================================================================
+//              Audio Log
+//
+//==============================================================================
+
+class AudioLog : private Thread {
+public:
+    enum Category {
+        general = 0,
+        route,
+        rendering,
+        commands,
+        numCategories
+    };
+
+    struct Message {
+        Category category;
+        const char *format;
+    };
+
+    static constexpr int maxArgs = 4;
+    static constexpr int capacity = 1024;
+    static constexpr int defaultRateLimit = 20;
+
+    AudioLog() : Thread("Audio log") {
+        for (auto &limit : rateLimits)
+            limit = defaultRateLimit;
+    }
+
+    ~AudioLog() {
+        stop();
+    }
+
+    /*=================================================================================*/
+
+    static const char *getCategoryName(int category) {
+        static const char *const names[] = {"General", "Route", "Rendering", "Commands"};
+        return names[category];
+    }
+
+    //Before start. Without a file the log goes to the console.
+    void setOutputFile(const File &file) {
+        jassert(!isThreadRunning());
+        outputFile = file;
+    }
+
+    //Before start. Messages of the category per second, 0 silences it.
+    void setRateLimit(Category category, int messagesPerSecond) {
+        jassert(!isThreadRunning());
+        rateLimits[category] = jmax(0, messagesPerSecond);
+    }
+
+    void start() {
+        if (outputFile != File())
+            output.reset(outputFile.createOutputStream());
+        startTicks = Time::getHighResolutionTicks();
+        startThread(2);
+    }
+
+    //Writes whatever is still queued, then stops the writer
+    void stop() {
+        signalThreadShouldExit();
+        notify();
+        stopThread(1000);
+        output.reset();
+    }
+
+    /*=================================================================================*/
+
+    //Audio thread only. Wait-free, the record is dropped when the ring is full.
+    void log(const Message &message, double a = 0, double b = 0, double c = 0, double d = 0) noexcept {
+        if (!records.push({&message, Time::getHighResolutionTicks(), {a, b, c, d}}))
+            dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    int64 getNumDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Record {
+        const Message *message;
+        int64 ticks;
+        double args[maxArgs];
+    };
+
+    void run() override {
+        while (!threadShouldExit()) {
+            wait(50);
+            writeQueued();
+        }
+        writeQueued();
+    }
+
+    //The window is one second of record time per category
+    void writeQueued() {
+        records.drain([this](const Record &record) {
+            const int category = record.message->category;
+            const double seconds = Time::highResolutionTicksToSeconds(record.ticks - startTicks);
+            if (seconds >= windowStarts[category] + 1.0) {
+                reportSuppressed(category);
+                windowStarts[category] = std::floor(seconds);
+                windowCounts[category] = 0;
+            }
+            if (++windowCounts[category] > rateLimits[category]) {
+                ++suppressed[category];
+                return;
+            }
+
+            char text[256];
+            snprintf(text, sizeof(text), record.message->format, record.args[0], record.args[1], record.args[2],
+                     record.args[3]);
+            write(String(seconds, 3) + " " + getCategoryName(category) + ": " + text);
+        });
+
+        const auto droppedNow = dropped.load(std::memory_order_relaxed);
+        if (droppedNow != reportedDropped) {
+            write(String(droppedNow - reportedDropped) + " audio log records dropped, the ring was full");
+            reportedDropped = droppedNow;
+        }
+    }
+
+    void reportSuppressed(int category) {
+        if (suppressed[category] > 0 && rateLimits[category] > 0)
+            write(String(suppressed[category]) + " " + getCategoryName(category)
+                  + " messages over the rate limit were not written");
+        suppressed[category] = 0;
+    }
+
+    void write(const String &line) {
+        if (output != nullptr) {
+            *output << line << "\n";
+            output->flush();
+        } else {
+            std::cout << line << "\n";
+        }
+    }
+
+    /*=================================================================================*/
+
+    CommandQueue<Record, capacity> records;
+    std::atomic<int64> dropped { 0 };
+
+    //Writer thread only, once started
+    File outputFile;
+    std::unique_ptr<FileOutputStream> output;
+    int64 startTicks = 0;
+    int rateLimits[numCategories];
+    double windowStarts[numCategories] = {};
+    int windowCounts[numCategories] = {};
+    int64 suppressed[numCategories] = {};
+    int64 reportedDropped = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AudioLog)
+};
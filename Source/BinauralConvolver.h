@@ -0,0 +1,549 @@
+/*==============================================================================
+//                      Binaural Convolution Engine
+//      Uniform-partitioned FFT convolution against a shared HRTF spectrum bank
+//==============================================================================
+// - HRTFSpectrumBank FFTs every HRIR once at load, split into partitions of
+//   the engine block size.
+// - BinauralConvolver keeps a frequency-domain delay line of the input per
+//   source; changing the HRTF only changes which spectra are read.
+// - In crossfade mode a change renders the old and new HRTF for one partition
+//   and ramps between them, with no allocation on the audio thread.
+// - Blends of neighbouring bank entries are written to a few slots owned by the
+//   convolver and switched to like any other HRTF.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+//              HRTF Spectrum Bank
+//              Partitioned spectra of every loaded HRIR, both ears
+//==============================================================================
+
+class HRTFSpectrumBank {
+public:
+    enum Ear {
+        left = 0,
+        right = 1
+    };
+
+    HRTFSpectrumBank() {}
+
+    /*=================================================================================*/
+
+    //Clears the bank and sets the partition layout for impulses of up to impulseLength taps
+    void setPartitionSize(int newPartitionSize, int newImpulseLength) {
+        jassert(isPowerOfTwo(newPartitionSize));
+
+        partitionSize = newPartitionSize;
+        impulseLength = newImpulseLength;
+        fftSize = partitionSize * 2;
+        numBins = fftSize / 2 + 1;
+        numSegments = (impulseLength + partitionSize - 1) / partitionSize;
+
+        fft = std::make_unique<dsp::FFT>(roundToInt(std::log2(fftSize)));
+        fftBuffer.assign((size_t) fftSize * 2, 0.0f);
+        spectra.clear();
+        impulseSegments.clear();
+        numImpulses = 0;
+    }
+
+    /*=================================================================================*/
+
+    //FFTs one left/right HRIR pair into the bank and returns its index. Shorter impulses
+    //only use as many segments as they need.
+    int addImpulse(const float *irLeft, const float *irRight, int length) {
+        jassert(fft != nullptr);
+        length = jmin(length, impulseLength);
+        impulseSegments.push_back(jmax(1, (length + partitionSize - 1) / partitionSize));
+
+        spectra.resize(spectra.size() + (size_t) getImpulseStride());
+        float *dest = spectra.data() + (size_t) numImpulses * getImpulseStride();
+
+        const float *irs[2] = {irLeft, irRight};
+        for (int ear = 0; ear < 2; ++ear) {
+            for (int segment = 0; segment < numSegments; ++segment) {
+                auto start = segment * partitionSize;
+                auto num = jlimit(0, partitionSize, length - start);
+
+                std::fill(fftBuffer.begin(), fftBuffer.end(), 0.0f);
+                if (num > 0)
+                    FloatVectorOperations::copy(fftBuffer.data(), irs[ear] + start, num);
+
+                fft->performRealOnlyForwardTransform(fftBuffer.data(), true);
+                interleavedToSplit(fftBuffer.data(), dest, numBins);
+                dest += getSegmentStride();
+            }
+        }
+        return numImpulses++;
+    }
+
+    /*=================================================================================*/
+
+    //Adopts spectra FFT'd earlier with the same partition layout, getImpulseStride floats
+    //as returned by getImpulseSpectra. No FFT runs.
+    int addSpectra(const float *impulseSpectra, int numSegmentsUsed) {
+        jassert(numSegmentsUsed > 0 && numSegmentsUsed <= numSegments);
+        impulseSegments.push_back(numSegmentsUsed);
+        spectra.insert(spectra.end(), impulseSpectra, impulseSpectra + getImpulseStride());
+        return numImpulses++;
+    }
+
+    //Both ears and every segment of one impulse, contiguous
+    const float *getImpulseSpectra(int index) const { return getSegment(index, left, 0); }
+
+    /*=================================================================================*/
+
+    //Split layout: numBins real parts followed by numBins imaginary parts
+    const float *getSegment(int index, int ear, int segment) const {
+        jassert(isPositiveAndBelow(index, numImpulses));
+        return spectra.data() + (size_t) index * getImpulseStride()
+               + (size_t) (ear * numSegments + segment) * getSegmentStride();
+    }
+
+    /*=================================================================================*/
+
+    static void interleavedToSplit(const float *interleaved, float *split, int bins) {
+        for (int i = 0; i < bins; ++i) {
+            split[i] = interleaved[2 * i];
+            split[bins + i] = interleaved[2 * i + 1];
+        }
+    }
+
+    /*=================================================================================*/
+
+    //Rebuilds the full conjugate-symmetric spectrum the inverse real FFT expects
+    static void splitToSymmetric(const float *split, float *interleaved, int bins, int size) {
+        for (int i = 0; i < bins; ++i) {
+            interleaved[2 * i] = split[i];
+            interleaved[2 * i + 1] = split[bins + i];
+        }
+        for (int i = bins; i < size; ++i) {
+            interleaved[2 * i] = split[size - i];
+            interleaved[2 * i + 1] = -split[bins + size - i];
+        }
+    }
+
+    /*=================================================================================*/
+
+    //FFTs one partition of input into a split spectrum at dest, scratch holds getFFTSize() * 2
+    //floats. Engines keep their own scratch so several can share the bank.
+    void transformBlock(const float *input, float *scratch, float *dest) const {
+        std::fill(scratch, scratch + fftSize * 2, 0.0f);
+        FloatVectorOperations::copy(scratch, input, partitionSize);
+
+        fft->performRealOnlyForwardTransform(scratch, true);
+        interleavedToSplit(scratch, dest, numBins);
+    }
+
+    /*=================================================================================*/
+
+    //dest += a * b on split spectra of bins complex values
+    static void multiplyAccumulate(float *__restrict dest, const float *__restrict a, const float *__restrict b,
+                                   int bins) {
+        const float *aIm = a + bins;
+        const float *bIm = b + bins;
+        float *destIm = dest + bins;
+
+        for (int i = 0; i < bins; ++i) {
+            dest[i] += a[i] * b[i] - aIm[i] * bIm[i];
+            destIm[i] += a[i] * bIm[i] + aIm[i] * b[i];
+        }
+    }
+
+    /*=================================================================================*/
+
+    int getPartitionSize() const { return partitionSize; }
+
+    int getFFTSize() const { return fftSize; }
+
+    int getNumBins() const { return numBins; }
+
+    int getNumSegments() const { return numSegments; }
+
+    int getNumSegments(int index) const { return impulseSegments[(size_t) index]; }
+
+    int getSegmentStride() const { return numBins * 2; }
+
+    int getImpulseStride() const { return getSegmentStride() * numSegments * 2; }
+
+    int size() const { return numImpulses; }
+
+    const dsp::FFT &getFFT() const { return *fft; }
+
+private:
+    int partitionSize = 0;
+    int impulseLength = 0;
+    int fftSize = 0;
+    int numBins = 0;
+    int numSegments = 0;
+    int numImpulses = 0;
+
+    std::unique_ptr<dsp::FFT> fft;
+    std::vector<float> fftBuffer;
+    std::vector<float> spectra;
+    std::vector<int> impulseSegments;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HRTFSpectrumBank)
+};
+
+//==============================================================================
+//              Binaural Convolver
+//              Per source frequency-domain delay line, zero latency
+//==============================================================================
+
+class BinauralConvolver {
+public:
+    enum SwitchMode {
+        immediate,      //new spectra are used from the next sample, may click
+        crossfade       //old and new HRTF are rendered for one partition and crossfaded
+    };
+
+    //Most bank entries a single blend can mix
+    static constexpr int maxBlendImpulses = 3;
+
+    BinauralConvolver() {}
+
+    /*=================================================================================*/
+
+    //Allocates the delay lines for the bank's partition layout. Set sharedInput when both
+    //ears are fed from the same (mono) signal so the input is only transformed once.
+    void prepare(const HRTFSpectrumBank &spectrumBank, bool sharedInput) {
+        bank = &spectrumBank;
+        numInputs = sharedInput ? 1 : 2;
+
+        auto partitionSize = bank->getPartitionSize();
+        auto segmentStride = bank->getSegmentStride();
+
+        //One extra slot so the new HRTF's overlap can be rebuilt when a crossfade starts
+        numSlots = bank->getNumSegments() + 1;
+
+        for (int i = 0; i < 2; ++i) {
+            inputBlock[i].assign((size_t) partitionSize, 0.0f);
+            delayLine[i].assign((size_t) (segmentStride * numSlots), 0.0f);
+            accumulator[i].assign((size_t) segmentStride, 0.0f);
+            history[i].assign((size_t) segmentStride, 0.0f);
+            historyFadeOut[i].assign((size_t) segmentStride, 0.0f);
+            overlap[i].assign((size_t) partitionSize, 0.0f);
+            overlapFadeIn[i].assign((size_t) partitionSize, 0.0f);
+        }
+        fftBuffer.assign((size_t) bank->getFFTSize() * 2, 0.0f);
+        fadeOutBlock.assign((size_t) partitionSize, 0.0f);
+
+        fadeRamp.resize((size_t) partitionSize);
+        for (int i = 0; i < partitionSize; ++i)
+            fadeRamp[(size_t) i] = (float) (i + 1) / (float) partitionSize;
+
+        blendSpectra.assign((size_t) (bank->getImpulseStride() * numBlendSlots), 0.0f);
+        for (auto &blend : blends)
+            blend = Blend();
+
+        reset();
+    }
+
+    /*=================================================================================*/
+
+    void reset() {
+        for (int i = 0; i < 2; ++i) {
+            std::fill(inputBlock[i].begin(), inputBlock[i].end(), 0.0f);
+            std::fill(delayLine[i].begin(), delayLine[i].end(), 0.0f);
+            std::fill(overlap[i].begin(), overlap[i].end(), 0.0f);
+        }
+        inputPos = 0;
+        currentSegment = 0;
+        hrtfIndex = targetIndex;
+        fading = false;
+        running = false;
+    }
+
+    /*=================================================================================*/
+
+    void setSwitchMode(SwitchMode newMode) { switchMode = newMode; }
+
+    SwitchMode getSwitchMode() const { return switchMode; }
+
+    /*=================================================================================*/
+
+    //Real-time safe, the delay line keeps running with the new spectra. In crossfade mode the
+    //switch starts at the next partition boundary; later requests just replace the target.
+    void setHrtf(int index) {
+        jassert(bank != nullptr && isPositiveAndBelow(index, bank->size() + numBlendSlots));
+        targetIndex = index;
+
+        //Nothing to fade from before the first block after a reset
+        if (switchMode == immediate || !running)
+            hrtfIndex = index;
+    }
+
+    int getHrtf() const { return targetIndex; }
+
+    bool isCrossfading() const { return fading; }
+
+    /*=================================================================================*/
+
+    //Real weighted sum of bank spectra, switched to like setHrtf. Asking for the blend that
+    //is already the target does nothing, so this can be called every block.
+    void setHrtfBlend(const int *indices, const float *weights, int count) {
+        jassert(bank != nullptr && count > 0 && count <= maxBlendImpulses);
+
+        //A single entry at full weight is just that entry
+        if (count == 1 && weights[0] == 1.0f) {
+            setHrtf(indices[0]);
+            return;
+        }
+
+        const int base = bank->size();
+        if (targetIndex >= base && blends[targetIndex - base].matches(indices, weights, count))
+            return;
+
+        //Any slot that is not being rendered from, a pending target can be overwritten
+        int slot = 0;
+        while (base + slot == hrtfIndex || (fading && base + slot == fadeOutIndex))
+            ++slot;
+
+        auto &blend = blends[slot];
+        blend.count = count;
+        blend.numSegments = 1;
+        for (int i = 0; i < count; ++i) {
+            blend.indices[i] = indices[i];
+            blend.weights[i] = weights[i];
+            blend.numSegments = jmax(blend.numSegments, bank->getNumSegments(indices[i]));
+        }
+
+        auto stride = bank->getSegmentStride();
+        float *slotSpectra = blendSpectra.data() + (size_t) slot * bank->getImpulseStride();
+        for (int ear = 0; ear < 2; ++ear)
+            for (int segment = 0; segment < blend.numSegments; ++segment) {
+                float *dest = slotSpectra + (size_t) (ear * bank->getNumSegments() + segment) * stride;
+                FloatVectorOperations::copyWithMultiply(dest, bank->getSegment(indices[0], ear, segment), weights[0],
+                                                        stride);
+                for (int i = 1; i < count; ++i)
+                    FloatVectorOperations::addWithMultiply(dest, bank->getSegment(indices[i], ear, segment),
+                                                           weights[i], stride);
+            }
+
+        setHrtf(base + slot);
+    }
+
+    /*=================================================================================*/
+
+    //Left ear convolves inputLeft, right ear convolves inputRight. Outputs may alias the inputs.
+    void process(const float *inputLeft, const float *inputRight, float *outputLeft, float *outputRight,
+                 int numSamples) {
+        jassert(bank != nullptr);
+
+        const float *inputs[2] = {inputLeft, inputRight};
+        float *outputs[2] = {outputLeft, outputRight};
+        auto partitionSize = bank->getPartitionSize();
+        int processed = 0;
+        running = true;
+
+        while (processed < numSamples) {
+            const bool newBlock = (inputPos == 0);
+            const int num = jmin(numSamples - processed, partitionSize - inputPos);
+
+            //Transform the partially filled input block into the head of the delay line
+            for (int in = 0; in < numInputs; ++in) {
+                FloatVectorOperations::copy(inputBlock[in].data() + inputPos, inputs[in] + processed, num);
+                transformInput(in);
+            }
+
+            //Contributions of the previous blocks only change once per partition
+            if (newBlock) {
+                if (targetIndex != hrtfIndex)
+                    beginCrossfade();
+
+                for (int ear = 0; ear < 2; ++ear)
+                    accumulateHistory(ear, hrtfIndex, 1, history[ear].data());
+            }
+
+            for (int ear = 0; ear < 2; ++ear) {
+                float *out = outputs[ear] + processed;
+
+                if (fading) {
+                    renderEar(ear, fadeOutIndex, historyFadeOut[ear].data());
+                    FloatVectorOperations::add(fadeOutBlock.data(), fftBuffer.data() + inputPos,
+                                               overlap[ear].data() + inputPos, num);
+
+                    renderEar(ear, hrtfIndex, history[ear].data());
+                    FloatVectorOperations::add(out, fftBuffer.data() + inputPos,
+                                               overlapFadeIn[ear].data() + inputPos, num);
+
+                    //out = old + (new - old) * ramp
+                    FloatVectorOperations::subtract(out, fadeOutBlock.data(), num);
+                    FloatVectorOperations::multiply(out, fadeRamp.data() + inputPos, num);
+                    FloatVectorOperations::add(out, fadeOutBlock.data(), num);
+                } else {
+                    renderEar(ear, hrtfIndex, history[ear].data());
+                    FloatVectorOperations::add(out, fftBuffer.data() + inputPos,
+                                               overlap[ear].data() + inputPos, num);
+                }
+
+                if (inputPos + num == partitionSize)
+                    FloatVectorOperations::copy(overlap[ear].data(), fftBuffer.data() + partitionSize,
+                                                partitionSize);
+            }
+
+            inputPos += num;
+            processed += num;
+
+            if (inputPos == partitionSize)
+                advanceBlock();
+        }
+    }
+
+    /*=================================================================================*/
+
+    void processBlock(AudioSampleBuffer &buffer) {
+        jassert(numInputs == 2 && buffer.getNumChannels() >= 2);
+        process(buffer.getReadPointer(0), buffer.getReadPointer(1), buffer.getWritePointer(0),
+                buffer.getWritePointer(1), buffer.getNumSamples());
+    }
+
+private:
+    /*=================================================================================*/
+
+    const float *getInputSegment(int input, int age) const {
+        auto slot = (currentSegment + age) % numSlots;
+        return delayLine[input].data() + (size_t) slot * bank->getSegmentStride();
+    }
+
+    /*=================================================================================*/
+
+    //Indices past the bank are the blend slots, laid out like bank entries
+    const float *getFilterSegment(int index, int ear, int segment) const {
+        if (index < bank->size())
+            return bank->getSegment(index, ear, segment);
+
+        return blendSpectra.data() + (size_t) (index - bank->size()) * bank->getImpulseStride()
+               + (size_t) (ear * bank->getNumSegments() + segment) * bank->getSegmentStride();
+    }
+
+    int getFilterSegments(int index) const {
+        return index < bank->size() ? bank->getNumSegments(index) : blends[index - bank->size()].numSegments;
+    }
+
+    /*=================================================================================*/
+
+    void transformInput(int input) {
+        auto *head = delayLine[input].data() + (size_t) currentSegment * bank->getSegmentStride();
+        bank->transformBlock(inputBlock[input].data(), fftBuffer.data(), head);
+    }
+
+    /*=================================================================================*/
+
+    //Sum of X[k - age - i] * H[i] over the segments i >= firstSegment
+    void accumulateHistory(int ear, int index, int firstSegment, float *dest, int age = 0) const {
+        auto bins = bank->getNumBins();
+        auto input = jmin(ear, numInputs - 1);
+        std::fill(dest, dest + bank->getSegmentStride(), 0.0f);
+
+        for (int segment = firstSegment; segment < getFilterSegments(index); ++segment)
+            HRTFSpectrumBank::multiplyAccumulate(dest, getInputSegment(input, segment + age),
+                                                 getFilterSegment(index, ear, segment), bins);
+    }
+
+    /*=================================================================================*/
+
+    //Old HRTF keeps its history and overlap, new HRTF gets the overlap it would have produced
+    //from the previous block. Only touches preallocated buffers.
+    void beginCrossfade() {
+        fadeOutIndex = hrtfIndex;
+        hrtfIndex = targetIndex;
+        fading = (switchMode == crossfade);
+
+        if (!fading)
+            return;
+
+        auto bins = bank->getNumBins();
+        auto partitionSize = bank->getPartitionSize();
+
+        for (int ear = 0; ear < 2; ++ear) {
+            accumulateHistory(ear, fadeOutIndex, 1, historyFadeOut[ear].data());
+
+            auto &acc = accumulator[ear];
+            accumulateHistory(ear, hrtfIndex, 0, acc.data(), 1);
+            HRTFSpectrumBank::splitToSymmetric(acc.data(), fftBuffer.data(), bins, bank->getFFTSize());
+            bank->getFFT().performRealOnlyInverseTransform(fftBuffer.data());
+            FloatVectorOperations::copy(overlapFadeIn[ear].data(), fftBuffer.data() + partitionSize, partitionSize);
+        }
+    }
+
+    /*=================================================================================*/
+
+    //Adds the head segment to the history and leaves the time-domain block in fftBuffer
+    void renderEar(int ear, int index, const float *historySum) {
+        auto bins = bank->getNumBins();
+        auto input = jmin(ear, numInputs - 1);
+        auto &acc = accumulator[ear];
+
+        FloatVectorOperations::copy(acc.data(), historySum, bank->getSegmentStride());
+        HRTFSpectrumBank::multiplyAccumulate(acc.data(), getInputSegment(input, 0), getFilterSegment(index, ear, 0),
+                                             bins);
+
+        HRTFSpectrumBank::splitToSymmetric(acc.data(), fftBuffer.data(), bins, bank->getFFTSize());
+        bank->getFFT().performRealOnlyInverseTransform(fftBuffer.data());
+    }
+
+    /*=================================================================================*/
+
+    void advanceBlock() {
+        inputPos = 0;
+        currentSegment = (currentSegment + numSlots - 1) % numSlots;
+        fading = false;
+
+        for (int in = 0; in < numInputs; ++in)
+            std::fill(inputBlock[in].begin(), inputBlock[in].end(), 0.0f);
+    }
+
+    /*=================================================================================*/
+
+    //The current and fading out filters can both be blends, one more slot takes the next
+    static constexpr int numBlendSlots = 3;
+
+    struct Blend {
+        int indices[maxBlendImpulses] = {};
+        float weights[maxBlendImpulses] = {};
+        int count = 0;
+        int numSegments = 1;
+
+        bool matches(const int *otherIndices, const float *otherWeights, int otherCount) const {
+            if (otherCount != count)
+                return false;
+            for (int i = 0; i < count; ++i)
+                if (otherIndices[i] != indices[i] || otherWeights[i] != weights[i])
+                    return false;
+            return true;
+        }
+    };
+
+    /*=================================================================================*/
+
+    const HRTFSpectrumBank *bank = nullptr;
+    SwitchMode switchMode = crossfade;
+    int numInputs = 2;
+    int numSlots = 1;
+    int hrtfIndex = 0;
+    int targetIndex = 0;
+    int fadeOutIndex = 0;
+    bool fading = false;
+    bool running = false;
+    int inputPos = 0;
+    int currentSegment = 0;
+
+    std::vector<float> inputBlock[2];
+    std::vector<float> delayLine[2];
+    std::vector<float> accumulator[2];
+    std::vector<float> history[2];
+    std::vector<float> historyFadeOut[2];
+    std::vector<float> overlap[2];
+    std::vector<float> overlapFadeIn[2];
+    std::vector<float> fftBuffer;
+    std::vector<float> fadeOutBlock;
+    std::vector<float> fadeRamp;
+    std::vector<float> blendSpectra;
+    Blend blends[numBlendSlots];
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BinauralConvolver)
+};
@@ -0,0 +1,235 @@
+/*==============================================================================
+//                      Callback Monitor
+//      Load, stage latencies and deadline misses of the audio callback
+//==============================================================================
+// - The audio thread stamps the start and end of every callback and adds the
+//   ticks each stage took. At the end of the callback every stage lands in
+//   its own log scale histogram, eight buckets per octave.
+// - All counters are relaxed atomics with the audio thread as the only
+//   writer, so any other thread can read a report or export it at any time
+//   without a lock and without the audio thread noticing.
+// - A deadline miss is a callback that took longer than the audio it made.
+//   A late callback started more than one and a half blocks after the
+//   previous one, i.e. the device most likely dropped audio in between.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+//              Callback Monitor
+//
+//==============================================================================
+
+class CallbackMonitor {
+public:
+    enum Stage {
+        callback = 0,   //the whole getNextAudioBlock
+        route,          //player positions, followRoute
+        convolution,    //clip reads, HRTF convolution and interaural delay
+        mix,            //gain ramps into the bus, static loops and streamed beds
+        ambisonics,     //SH encode and binaural decode
+        numStages
+    };
+
+    static constexpr int bucketsPerOctave = 8;
+    //Bucket 0 is everything under a microsecond, the last one everything over ~260 ms
+    static constexpr int numBuckets = 1 + 18 * bucketsPerOctave;
+
+    struct StageReport {
+        int64 count;
+        double meanMicros;
+        double p50Micros;
+        double p99Micros;
+        double maxMicros;
+    };
+
+    struct Report {
+        StageReport stages[numStages];
+        int64 callbacks;
+        int64 deadlineMisses;
+        int64 lateCallbacks;
+        //Callback time over the audio it made, averaged over roughly the last 50 callbacks
+        double load;
+        double peakLoad;
+    };
+
+    CallbackMonitor() {
+        for (auto &stage : stages)
+            clear(stage);
+    }
+
+    /*=================================================================================*/
+
+    static const char *getStageName(int stage) {
+        static const char *const names[] = {"Callback", "Route", "Convolution", "Mix", "Ambisonics"};
+        return names[stage];
+    }
+
+    //Audio thread only
+    void beginCallback() {
+        if (resetRequested.exchange(false, std::memory_order_relaxed)) {
+            for (auto &stage : stages)
+                clear(stage);
+            callbacks.store(0, std::memory_order_relaxed);
+            deadlineMisses.store(0, std::memory_order_relaxed);
+            lateCallbacks.store(0, std::memory_order_relaxed);
+            load.store(0, std::memory_order_relaxed);
+            peakLoad.store(0, std::memory_order_relaxed);
+            lastStartTicks = 0;
+        }
+
+        const auto now = Time::getHighResolutionTicks();
+        if (lastStartTicks != 0 && (double) (now - lastStartTicks) > 1.5 * (double) lastBlockTicks)
+            lateCallbacks.fetch_add(1, std::memory_order_relaxed);
+        lastStartTicks = startTicks = now;
+        std::fill(std::begin(stageTicks), std::end(stageTicks), 0);
+    }
+
+    //Audio thread only, ticks add up over the callback
+    void addStageTicks(Stage stage, int64 ticks) {
+        stageTicks[stage] += ticks;
+    }
+
+    //Audio thread only. Records every stage that ran and checks the deadline.
+    void endCallback(int numSamples, double sampleRate) {
+        const auto now = Time::getHighResolutionTicks();
+        stageTicks[callback] = now - startTicks;
+        for (int i = 0; i < numStages; ++i)
+            if (i == callback || stageTicks[i] > 0)
+                record(stages[i], Time::highResolutionTicksToSeconds(stageTicks[i]) * 1.0e6);
+
+        const double deadline = numSamples / sampleRate;
+        lastBlockTicks = (int64) (deadline * (double) Time::getHighResolutionTicksPerSecond());
+        const double callbackLoad = Time::highResolutionTicksToSeconds(stageTicks[callback]) / jmax(1.0e-9, deadline);
+        if (callbackLoad > 1.0)
+            deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+
+        const double smoothed = load.load(std::memory_order_relaxed);
+        load.store(smoothed + (callbackLoad - smoothed) * 0.02, std::memory_order_relaxed);
+        if (callbackLoad > peakLoad.load(std::memory_order_relaxed))
+            peakLoad.store(callbackLoad, std::memory_order_relaxed);
+        callbacks.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /*=================================================================================*/
+
+    //Any thread. The audio thread clears everything at the start of its next callback.
+    void requestReset() {
+        resetRequested.store(true, std::memory_order_relaxed);
+    }
+
+    //Any thread. Counters are read one by one, so a report may straddle a callback.
+    Report getReport() const {
+        Report report;
+        for (int i = 0; i < numStages; ++i) {
+            auto &stage = stages[i];
+            auto &stageReport = report.stages[i];
+            int64 counts[numBuckets];
+            int64 count = 0;
+            for (int b = 0; b < numBuckets; ++b)
+                count += counts[b] = stage.buckets[b].load(std::memory_order_relaxed);
+
+            stageReport.count = count;
+            stageReport.meanMicros = count > 0 ? stage.sumMicros.load(std::memory_order_relaxed) / count : 0.0;
+            stageReport.p50Micros = getPercentile(counts, count, 0.5);
+            stageReport.p99Micros = getPercentile(counts, count, 0.99);
+            stageReport.maxMicros = stage.maxMicros.load(std::memory_order_relaxed);
+        }
+        report.callbacks = callbacks.load(std::memory_order_relaxed);
+        report.deadlineMisses = deadlineMisses.load(std::memory_order_relaxed);
+        report.lateCallbacks = lateCallbacks.load(std::memory_order_relaxed);
+        report.load = load.load(std::memory_order_relaxed);
+        report.peakLoad = peakLoad.load(std::memory_order_relaxed);
+        return report;
+    }
+
+    //Any thread. One summary row per stage, then every stage's histogram by bucket.
+    bool writeCsv(const File &file) const {
+        auto report = getReport();
+        String csv = "callbacks," + String(report.callbacks) + ",deadlineMisses," + String(report.deadlineMisses)
+                     + ",lateCallbacks," + String(report.lateCallbacks) + ",load," + String(report.load)
+                     + ",peakLoad," + String(report.peakLoad) + "\n";
+        csv << "stage,count,meanMicros,p50Micros,p99Micros,maxMicros\n";
+        for (int i = 0; i < numStages; ++i) {
+            auto &stage = report.stages[i];
+            csv << getStageName(i) << "," << stage.count << "," << stage.meanMicros << "," << stage.p50Micros << ","
+                << stage.p99Micros << "," << stage.maxMicros << "\n";
+        }
+
+        csv << "bucketUpToMicros";
+        for (int i = 0; i < numStages; ++i)
+            csv << "," << getStageName(i);
+        csv << "\n";
+        for (int b = 0; b < numBuckets; ++b) {
+            csv << getBucketLimit(b);
+            for (auto &stage : stages)
+                csv << "," << (int64) stage.buckets[b].load(std::memory_order_relaxed);
+            csv << "\n";
+        }
+        return file.replaceWithText(csv);
+    }
+
+private:
+    struct StageHistogram {
+        std::atomic<int64> buckets[numBuckets];
+        std::atomic<double> sumMicros;
+        std::atomic<double> maxMicros;
+    };
+
+    static void clear(StageHistogram &stage) {
+        for (auto &bucket : stage.buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        stage.sumMicros.store(0, std::memory_order_relaxed);
+        stage.maxMicros.store(0, std::memory_order_relaxed);
+    }
+
+    //Single writer, so plain load and store instead of read-modify-write on the doubles
+    static void record(StageHistogram &stage, double micros) {
+        stage.buckets[getBucket(micros)].fetch_add(1, std::memory_order_relaxed);
+        stage.sumMicros.store(stage.sumMicros.load(std::memory_order_relaxed) + micros, std::memory_order_relaxed);
+        if (micros > stage.maxMicros.load(std::memory_order_relaxed))
+            stage.maxMicros.store(micros, std::memory_order_relaxed);
+    }
+
+    static int getBucket(double micros) {
+        if (micros < 1.0)
+            return 0;
+        return jmin(numBuckets - 1, 1 + (int) (std::log2(micros) * bucketsPerOctave));
+    }
+
+    static double getBucketLimit(int bucket) {
+        return std::exp2((double) bucket / bucketsPerOctave);
+    }
+
+    //Upper edge of the bucket the percentile falls in, so at most 9% high
+    static double getPercentile(const int64 *counts, int64 total, double fraction) {
+        if (total == 0)
+            return 0.0;
+        const auto rank = (int64) std::ceil(fraction * (double) total);
+        int64 seen = 0;
+        for (int b = 0; b < numBuckets; ++b)
+            if ((seen += counts[b]) >= rank)
+                return getBucketLimit(b);
+        return getBucketLimit(numBuckets - 1);
+    }
+
+    /*=================================================================================*/
+
+    StageHistogram stages[numStages];
+    std::atomic<int64> callbacks { 0 };
+    std::atomic<int64> deadlineMisses { 0 };
+    std::atomic<int64> lateCallbacks { 0 };
+    std::atomic<double> load { 0 };
+    std::atomic<double> peakLoad { 0 };
+    std::atomic<bool> resetRequested { false };
+
+    //Audio thread only
+    int64 startTicks = 0;
+    int64 lastStartTicks = 0;
+    int64 lastBlockTicks = 0;
+    int64 stageTicks[numStages] = {};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CallbackMonitor)
+};
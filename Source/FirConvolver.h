@@ -0,0 +1,469 @@
+/*==============================================================================
+//                      Direct Form FIR Convolution
+//      Time-domain backend for short HRIRs and small device blocks
+//==============================================================================
+// - HRIRTapBank stores every HRIR reversed and zero padded to a multiple of 16
+//   taps, 64 byte aligned, so the kernels only do full vector loads.
+// - FirConvolver keeps a mirrored circular history of its mono input and
+//   renders both ears from the same window in one pass.
+// - The kernel is picked at runtime: AVX-512, AVX2/FMA or SSE2, with a plain
+//   C++ fallback on non Intel targets.
+// - Blends of neighbouring bank entries are summed into aligned slots owned by
+//   the convolver, in the same reversed layout as the bank.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#if JUCE_INTEL
+ #include <immintrin.h>
+ #if JUCE_MSVC
+  #define UP_TARGET(isa)
+ #else
+  #define UP_TARGET(isa) __attribute__((target(isa)))
+ #endif
+#endif
+
+//==============================================================================
+//              FIR Kernels
+//              out[j] = sum_k x[j + k] * taps[k] for both ears
+//==============================================================================
+
+namespace FirKernels {
+    typedef void (*StereoKernel)(const float *x, const float *tapsL, const float *tapsR, int numTaps,
+                                 float *outL, float *outR, int numSamples);
+
+    /*=================================================================================*/
+
+    inline void processScalar(const float *x, const float *tapsL, const float *tapsR, int numTaps,
+                              float *outL, float *outR, int numSamples) {
+        for (int j = 0; j < numSamples; ++j) {
+            const float *window = x + j;
+            float sumL = 0, sumR = 0;
+            for (int k = 0; k < numTaps; ++k) {
+                sumL += window[k] * tapsL[k];
+                sumR += window[k] * tapsR[k];
+            }
+            outL[j] = sumL;
+            outR[j] = sumR;
+        }
+    }
+
+#if JUCE_INTEL
+    /*=================================================================================*/
+
+    inline float horizontalSum(__m128 v) {
+        __m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+        __m128 sums = _mm_add_ps(v, shuffled);
+        shuffled = _mm_movehl_ps(shuffled, sums);
+        return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+    }
+
+    /*=================================================================================*/
+
+    inline void processSSE2(const float *x, const float *tapsL, const float *tapsR, int numTaps,
+                            float *outL, float *outR, int numSamples) {
+        for (int j = 0; j < numSamples; ++j) {
+            const float *window = x + j;
+            __m128 sumL = _mm_setzero_ps();
+            __m128 sumR = _mm_setzero_ps();
+
+            for (int k = 0; k < numTaps; k += 4) {
+                __m128 in = _mm_loadu_ps(window + k);
+                sumL = _mm_add_ps(sumL, _mm_mul_ps(in, _mm_load_ps(tapsL + k)));
+                sumR = _mm_add_ps(sumR, _mm_mul_ps(in, _mm_load_ps(tapsR + k)));
+            }
+            outL[j] = horizontalSum(sumL);
+            outR[j] = horizontalSum(sumR);
+        }
+    }
+
+    /*=================================================================================*/
+
+    UP_TARGET("avx2,fma")
+    inline void processAVX2(const float *x, const float *tapsL, const float *tapsR, int numTaps,
+                            float *outL, float *outR, int numSamples) {
+        for (int j = 0; j < numSamples; ++j) {
+            const float *window = x + j;
+            __m256 sumL = _mm256_setzero_ps();
+            __m256 sumR = _mm256_setzero_ps();
+
+            for (int k = 0; k < numTaps; k += 8) {
+                __m256 in = _mm256_loadu_ps(window + k);
+                sumL = _mm256_fmadd_ps(in, _mm256_load_ps(tapsL + k), sumL);
+                sumR = _mm256_fmadd_ps(in, _mm256_load_ps(tapsR + k), sumR);
+            }
+            __m128 l = _mm_add_ps(_mm256_castps256_ps128(sumL), _mm256_extractf128_ps(sumL, 1));
+            __m128 r = _mm_add_ps(_mm256_castps256_ps128(sumR), _mm256_extractf128_ps(sumR, 1));
+            outL[j] = horizontalSum(l);
+            outR[j] = horizontalSum(r);
+        }
+    }
+
+    /*=================================================================================*/
+
+    UP_TARGET("avx512f")
+    inline void processAVX512(const float *x, const float *tapsL, const float *tapsR, int numTaps,
+                              float *outL, float *outR, int numSamples) {
+        for (int j = 0; j < numSamples; ++j) {
+            const float *window = x + j;
+            __m512 sumL = _mm512_setzero_ps();
+            __m512 sumR = _mm512_setzero_ps();
+
+            for (int k = 0; k < numTaps; k += 16) {
+                __m512 in = _mm512_loadu_ps(window + k);
+                sumL = _mm512_fmadd_ps(in, _mm512_load_ps(tapsL + k), sumL);
+                sumR = _mm512_fmadd_ps(in, _mm512_load_ps(tapsR + k), sumR);
+            }
+            outL[j] = _mm512_reduce_add_ps(sumL);
+            outR[j] = _mm512_reduce_add_ps(sumR);
+        }
+    }
+#endif
+
+    /*=================================================================================*/
+
+    inline StereoKernel getBestKernel(String &name) {
+       #if JUCE_INTEL
+        if (SystemStats::hasAVX512F()) {
+            name = "AVX-512";
+            return processAVX512;
+        }
+        if (SystemStats::hasAVX2() && SystemStats::hasFMA3()) {
+            name = "AVX2";
+            return processAVX2;
+        }
+        name = "SSE2";
+        return processSSE2;
+       #else
+        name = "Scalar";
+        return processScalar;
+       #endif
+    }
+}
+
+//==============================================================================
+//              HRIR Tap Bank
+//              Reversed, padded and aligned time-domain taps for both ears
+//==============================================================================
+
+class HRIRTapBank {
+public:
+    enum Ear {
+        left = 0,
+        right = 1
+    };
+
+    static constexpr int tapAlignment = 16;
+
+    HRIRTapBank() {}
+
+    /*=================================================================================*/
+
+    //Clears the bank for impulses of up to impulseLength taps
+    void setImpulseLength(int newImpulseLength, int expectedImpulses) {
+        impulseLength = newImpulseLength;
+        paddedLength = ((impulseLength + tapAlignment - 1) / tapAlignment) * tapAlignment;
+        numImpulses = 0;
+        capacity = 0;
+        tapCounts.clear();
+        reserve(expectedImpulses);
+    }
+
+    /*=================================================================================*/
+
+    //Shorter impulses keep their own padded tap count so the kernel skips the zeros
+    int addImpulse(const float *irLeft, const float *irRight, int length) {
+        length = jmin(length, impulseLength);
+        if (numImpulses == capacity)
+            reserve(jmax(16, capacity * 2));
+
+        const int tapCount = jmax(tapAlignment, ((length + tapAlignment - 1) / tapAlignment) * tapAlignment);
+        tapCounts.push_back(tapCount);
+
+        const float *irs[2] = {irLeft, irRight};
+        for (int ear = 0; ear < 2; ++ear) {
+            float *dest = taps + (size_t) (numImpulses * 2 + ear) * paddedLength;
+            FloatVectorOperations::clear(dest, paddedLength);
+
+            //Reversed so tap k multiplies the k-th oldest sample of the window
+            for (int k = 0; k < length; ++k)
+                dest[tapCount - 1 - k] = irs[ear][k];
+        }
+        return numImpulses++;
+    }
+
+    /*=================================================================================*/
+
+    const float *getTaps(int index, int ear) const {
+        jassert(isPositiveAndBelow(index, numImpulses));
+        return taps + (size_t) (index * 2 + ear) * paddedLength;
+    }
+
+    int getPaddedLength() const { return paddedLength; }
+
+    int getTapCount(int index) const { return tapCounts[(size_t) index]; }
+
+    int size() const { return numImpulses; }
+
+private:
+    /*=================================================================================*/
+
+    void reserve(int newCapacity) {
+        if (newCapacity <= capacity)
+            return;
+
+        //64 byte alignment for the aligned vector loads of the kernels
+        HeapBlock<char> newStorage((size_t) newCapacity * 2 * paddedLength * sizeof(float) + 64);
+        auto *newTaps = reinterpret_cast<float *>((reinterpret_cast<uintptr_t>(newStorage.get()) + 63) & ~(uintptr_t) 63);
+
+        if (numImpulses > 0)
+            FloatVectorOperations::copy(newTaps, taps, numImpulses * 2 * paddedLength);
+
+        storage.swapWith(newStorage);
+        taps = newTaps;
+        capacity = newCapacity;
+    }
+
+    /*=================================================================================*/
+
+    int impulseLength = 0;
+    int paddedLength = 0;
+    int numImpulses = 0;
+    int capacity = 0;
+
+    HeapBlock<char> storage;
+    float *taps = nullptr;
+    std::vector<int> tapCounts;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HRIRTapBank)
+};
+
+//==============================================================================
+//              FIR Convolver
+//              Mono in, both ears out, mirrored circular history
+//==============================================================================
+
+class FirConvolver {
+public:
+    //Most bank entries a single blend can mix
+    static constexpr int maxBlendImpulses = 3;
+
+    FirConvolver() {
+        kernel = FirKernels::getBestKernel(kernelName);
+    }
+
+    /*=================================================================================*/
+
+    void prepare(const HRIRTapBank &tapBank, int maxBlockSize) {
+        bank = &tapBank;
+        maxBlock = maxBlockSize;
+
+        //Every sample is written twice, so the window for a whole block is always contiguous
+        capacity = bank->getPaddedLength() + maxBlock;
+        history.assign((size_t) capacity * 2, 0.0f);
+        fadeOut[0].assign((size_t) maxBlock, 0.0f);
+        fadeOut[1].assign((size_t) maxBlock, 0.0f);
+
+        rampIndex.resize((size_t) maxBlock);
+        for (int i = 0; i < maxBlock; ++i)
+            rampIndex[(size_t) i] = (float) (i + 1);
+
+        //64 byte alignment for the aligned vector loads of the kernels
+        auto paddedLength = bank->getPaddedLength();
+        blendStorage.calloc((size_t) numBlendSlots * 2 * paddedLength * sizeof(float) + 64);
+        blendTaps = reinterpret_cast<float *>((reinterpret_cast<uintptr_t>(blendStorage.get()) + 63) & ~(uintptr_t) 63);
+        for (auto &blend : blends)
+            blend = Blend();
+
+        reset();
+    }
+
+    /*=================================================================================*/
+
+    void reset() {
+        std::fill(history.begin(), history.end(), 0.0f);
+        writePos = 0;
+        fadeOutIndex = hrtfIndex;
+        running = false;
+    }
+
+    /*=================================================================================*/
+
+    //Real-time safe, the next processed block crossfades from the previous HRIR
+    void setHrtf(int index) {
+        jassert(bank != nullptr && isPositiveAndBelow(index, bank->size() + numBlendSlots));
+        hrtfIndex = index;
+
+        //Nothing to fade from before the first block after a reset
+        if (!running)
+            fadeOutIndex = index;
+    }
+
+    int getHrtf() const { return hrtfIndex; }
+
+    /*=================================================================================*/
+
+    //Real weighted sum of bank taps, switched to like setHrtf. Asking for the blend that is
+    //already set does nothing, so this can be called every block.
+    void setHrtfBlend(const int *indices, const float *weights, int count) {
+        jassert(bank != nullptr && count > 0 && count <= maxBlendImpulses);
+
+        //A single entry at full weight is just that entry
+        if (count == 1 && weights[0] == 1.0f) {
+            setHrtf(indices[0]);
+            return;
+        }
+
+        const int base = bank->size();
+        if (hrtfIndex >= base && blends[hrtfIndex - base].matches(indices, weights, count))
+            return;
+
+        //The slot the next block fades out from must stay intact
+        int slot = (fadeOutIndex == base) ? 1 : 0;
+
+        auto &blend = blends[slot];
+        blend.count = count;
+        blend.tapCount = HRIRTapBank::tapAlignment;
+        for (int i = 0; i < count; ++i) {
+            blend.indices[i] = indices[i];
+            blend.weights[i] = weights[i];
+            blend.tapCount = jmax(blend.tapCount, bank->getTapCount(indices[i]));
+        }
+
+        //Taps are right aligned within their count, shorter impulses start further in
+        for (int ear = 0; ear < 2; ++ear) {
+            float *dest = blendTaps + (size_t) (slot * 2 + ear) * bank->getPaddedLength();
+            FloatVectorOperations::clear(dest, blend.tapCount);
+            for (int i = 0; i < count; ++i) {
+                auto tapCount = bank->getTapCount(indices[i]);
+                FloatVectorOperations::addWithMultiply(dest + blend.tapCount - tapCount,
+                                                       bank->getTaps(indices[i], ear), weights[i], tapCount);
+            }
+        }
+
+        setHrtf(base + slot);
+    }
+
+    /*=================================================================================*/
+
+    static String getKernelName() {
+        String name;
+        FirKernels::getBestKernel(name);
+        return name;
+    }
+
+    /*=================================================================================*/
+
+    //Outputs may alias the input
+    void process(const float *input, float *outputLeft, float *outputRight, int numSamples) {
+        jassert(bank != nullptr);
+        running = true;
+
+        for (int done = 0; done < numSamples;) {
+            int num = jmin(numSamples - done, maxBlock);
+            processChunk(input + done, outputLeft + done, outputRight + done, num);
+            done += num;
+        }
+    }
+
+private:
+    /*=================================================================================*/
+
+    void processChunk(const float *input, float *outputLeft, float *outputRight, int num) {
+        //Write the input in at most two spans, each into both halves of the mirror
+        for (int done = 0; done < num;) {
+            int span = jmin(num - done, capacity - writePos);
+            FloatVectorOperations::copy(history.data() + writePos, input + done, span);
+            FloatVectorOperations::copy(history.data() + writePos + capacity, input + done, span);
+            writePos = (writePos + span) % capacity;
+            done += span;
+        }
+
+        renderWith(hrtfIndex, num, outputLeft, outputRight);
+
+        if (fadeOutIndex != hrtfIndex) {
+            renderWith(fadeOutIndex, num, fadeOut[0].data(), fadeOut[1].data());
+
+            //out = old + (new - old) * (i + 1) / num
+            float *outputs[2] = {outputLeft, outputRight};
+            for (int ear = 0; ear < 2; ++ear) {
+                FloatVectorOperations::subtract(outputs[ear], fadeOut[ear].data(), num);
+                FloatVectorOperations::multiply(outputs[ear], rampIndex.data(), num);
+                FloatVectorOperations::multiply(outputs[ear], 1.0f / (float) num, num);
+                FloatVectorOperations::add(outputs[ear], fadeOut[ear].data(), num);
+            }
+            fadeOutIndex = hrtfIndex;
+        }
+    }
+
+    /*=================================================================================*/
+
+    //The window of each output ends at its input sample, short impulses start later in it
+    void renderWith(int index, int num, float *outputLeft, float *outputRight) const {
+        auto tapCount = getFilterTapCount(index);
+        auto newest = writePos + capacity - 1;
+        const float *window = history.data() + newest - (num - 1) - (tapCount - 1);
+
+        kernel(window, getFilterTaps(index, HRIRTapBank::left), getFilterTaps(index, HRIRTapBank::right), tapCount,
+               outputLeft, outputRight, num);
+    }
+
+    /*=================================================================================*/
+
+    //Indices past the bank are the blend slots
+    const float *getFilterTaps(int index, int ear) const {
+        if (index < bank->size())
+            return bank->getTaps(index, ear);
+
+        return blendTaps + (size_t) ((index - bank->size()) * 2 + ear) * bank->getPaddedLength();
+    }
+
+    int getFilterTapCount(int index) const {
+        return index < bank->size() ? bank->getTapCount(index) : blends[index - bank->size()].tapCount;
+    }
+
+    /*=================================================================================*/
+
+    //Only the slot being faded out from is in use between blocks, one more takes the next
+    static constexpr int numBlendSlots = 2;
+
+    struct Blend {
+        int indices[maxBlendImpulses] = {};
+        float weights[maxBlendImpulses] = {};
+        int count = 0;
+        int tapCount = HRIRTapBank::tapAlignment;
+
+        bool matches(const int *otherIndices, const float *otherWeights, int otherCount) const {
+            if (otherCount != count)
+                return false;
+            for (int i = 0; i < count; ++i)
+                if (otherIndices[i] != indices[i] || otherWeights[i] != weights[i])
+                    return false;
+            return true;
+        }
+    };
+
+    /*=================================================================================*/
+
+    const HRIRTapBank *bank = nullptr;
+    FirKernels::StereoKernel kernel = nullptr;
+    String kernelName;
+
+    int maxBlock = 0;
+    int capacity = 0;
+    int writePos = 0;
+    int hrtfIndex = 0;
+    int fadeOutIndex = 0;
+    bool running = false;
+
+    std::vector<float> history;
+    std::vector<float> fadeOut[2];
+    std::vector<float> rampIndex;
+    HeapBlock<char> blendStorage;
+    float *blendTaps = nullptr;
+    Blend blends[numBlendSlots];
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FirConvolver)
+};
@@ -0,0 +1,253 @@
+/*==============================================================================
+//                      Minimum Phase + ITD Decomposition
+//      Splits each HRIR into a short minimum-phase filter and an onset delay
+//==============================================================================
+// - The subject48 HRIRs carry the interaural delay as leading zeros. Removing
+//   it lets the spectral part be truncated to a few dozen taps.
+// - InterauralDelay puts the delay back per ear with a cubic fractional delay,
+//   gliding to the new delay over each block so moving sources do not click.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+//              HRIR Decomposition
+//
+//==============================================================================
+
+namespace HrirDecomposition {
+    //Fraction of the peak that marks the onset, -20 dB
+    static constexpr float onsetThreshold = 0.1f;
+
+    /*=================================================================================*/
+
+    //Fractional index where the impulse first reaches onsetThreshold of its peak
+    inline float findOnset(const float *ir, int length) {
+        float peak = 0;
+        for (int i = 0; i < length; ++i)
+            peak = jmax(peak, std::abs(ir[i]));
+
+        if (peak <= 0)
+            return 0;
+
+        const float threshold = peak * onsetThreshold;
+        for (int i = 0; i < length; ++i) {
+            float level = std::abs(ir[i]);
+            if (level >= threshold) {
+                if (i == 0)
+                    return 0;
+                //Interpolate between the last sample below and the first above the threshold
+                float previous = std::abs(ir[i - 1]);
+                return (float) (i - 1) + (threshold - previous) / (level - previous);
+            }
+        }
+        return 0;
+    }
+
+    /*=================================================================================*/
+
+    //Homomorphic minimum phase: fold the real cepstrum of the log magnitude onto positive
+    //quefrencies, truncated to outLength taps with a short fade at the end
+    inline void makeMinimumPhase(const float *ir, int length, float *minPhase, int outLength) {
+        const int order = jmax(8, (int) std::ceil(std::log2((double) length * 8)));
+        const int size = 1 << order;
+        dsp::FFT fft(order);
+
+        std::vector<std::complex<float>> spectrum((size_t) size), cepstrum((size_t) size);
+        for (int i = 0; i < length; ++i)
+            cepstrum[(size_t) i] = ir[i];
+
+        fft.perform(cepstrum.data(), spectrum.data(), false);
+        for (auto &bin : spectrum)
+            bin = std::log(jmax(std::abs(bin), 1.0e-6f));
+
+        fft.perform(spectrum.data(), cepstrum.data(), true);
+        for (int i = 1; i < size / 2; ++i)
+            cepstrum[(size_t) i] = 2.0f * cepstrum[(size_t) i].real();
+        cepstrum[0] = cepstrum[0].real();
+        cepstrum[(size_t) size / 2] = cepstrum[(size_t) size / 2].real();
+        for (int i = size / 2 + 1; i < size; ++i)
+            cepstrum[(size_t) i] = 0;
+
+        fft.perform(cepstrum.data(), spectrum.data(), false);
+        for (auto &bin : spectrum)
+            bin = std::exp(bin);
+
+        fft.perform(spectrum.data(), cepstrum.data(), true);
+
+        const int fadeLength = jmin(8, outLength);
+        for (int i = 0; i < outLength; ++i) {
+            float fade = 1.0f;
+            if (i >= outLength - fadeLength)
+                fade = 0.5f + 0.5f * std::cos(MathConstants<float>::pi * (float) (i - (outLength - fadeLength) + 1)
+                                               / (float) (fadeLength + 1));
+            minPhase[i] = i < size ? cepstrum[(size_t) i].real() * fade : 0.0f;
+        }
+    }
+}
+
+//==============================================================================
+//              Minimum Phase HRIR Set
+//              Short filters plus per ear onsets, same indexing as the raw bank
+//==============================================================================
+
+class MinimumPhaseHrirSet {
+public:
+    enum Ear {
+        left,
+        right
+    };
+
+    static constexpr int defaultLength = 48;
+
+    MinimumPhaseHrirSet() {}
+
+    /*=================================================================================*/
+
+    void clear(int newFilterLength) {
+        filterLength = newFilterLength;
+        filters.clear();
+        onsets.clear();
+    }
+
+    /*=================================================================================*/
+
+    int add(const float *irLeft, const float *irRight, int length) {
+        const float *irs[2] = {irLeft, irRight};
+        auto index = size();
+        filters.resize(filters.size() + (size_t) filterLength * 2);
+
+        for (int ear = 0; ear < 2; ++ear) {
+            onsets.push_back(HrirDecomposition::findOnset(irs[ear], length));
+            HrirDecomposition::makeMinimumPhase(irs[ear], length, filters.data() + (size_t) (index * 2 + ear) * filterLength,
+                                                filterLength);
+        }
+        return index;
+    }
+
+    /*=================================================================================*/
+
+    //Adds a pair decomposed earlier, filterLength taps per ear
+    int addDecomposed(const float *filterLeft, const float *filterRight, float onsetLeft, float onsetRight) {
+        auto index = size();
+        filters.insert(filters.end(), filterLeft, filterLeft + filterLength);
+        filters.insert(filters.end(), filterRight, filterRight + filterLength);
+        onsets.push_back(onsetLeft);
+        onsets.push_back(onsetRight);
+        return index;
+    }
+
+    /*=================================================================================*/
+
+    const float *getFilter(int index, int ear) const {
+        return filters.data() + (size_t) (index * 2 + ear) * filterLength;
+    }
+
+    float getOnset(int index, int ear) const { return onsets[(size_t) (index * 2 + ear)]; }
+
+    int getFilterLength() const { return filterLength; }
+
+    int size() const { return (int) onsets.size() / 2; }
+
+private:
+    int filterLength = defaultLength;
+    std::vector<float> filters;
+    std::vector<float> onsets;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MinimumPhaseHrirSet)
+};
+
+//==============================================================================
+//              Interaural Delay
+//              Two fractional delay lines with cubic Lagrange interpolation
+//==============================================================================
+
+class InterauralDelay {
+public:
+    //Longest onset the delay lines can hold, in samples
+    static constexpr int maxDelay = 128;
+
+    InterauralDelay() {
+        for (auto &line : lines)
+            line.assign((size_t) bufferSize, 0.0f);
+    }
+
+    /*=================================================================================*/
+
+    void reset() {
+        for (auto &line : lines)
+            std::fill(line.begin(), line.end(), 0.0f);
+        writePos = 0;
+        running = false;
+    }
+
+    /*=================================================================================*/
+
+    //The delay glides to the target over the next processed block
+    void setDelays(float delayLeft, float delayRight) {
+        target[0] = jlimit(0.0f, (float) maxDelay, delayLeft);
+        target[1] = jlimit(0.0f, (float) maxDelay, delayRight);
+
+        if (!running) {
+            current[0] = target[0];
+            current[1] = target[1];
+        }
+    }
+
+    /*=================================================================================*/
+
+    //Delays both ears in place
+    void process(float *left, float *right, int numSamples) {
+        float *channels[2] = {left, right};
+        running = true;
+
+        for (int i = 0; i < numSamples; ++i) {
+            const int pos = writePos;
+            writePos = (writePos + 1) & mask;
+
+            for (int ear = 0; ear < 2; ++ear) {
+                auto &line = lines[ear];
+                line[(size_t) pos] = channels[ear][i];
+
+                float delay = current[ear] + (target[ear] - current[ear]) * (float) (i + 1) / (float) numSamples;
+                channels[ear][i] = readCubic(line, pos, delay);
+            }
+        }
+        current[0] = target[0];
+        current[1] = target[1];
+    }
+
+private:
+    /*=================================================================================*/
+
+    //4 point Lagrange around the integer delay; delay >= 1 keeps every tap in the past
+    float readCubic(const std::vector<float> &line, int pos, float delay) const {
+        delay = jmax(1.0f, delay);
+        const int whole = (int) delay;
+        const float d = delay - (float) whole;
+
+        auto tap = [&](int offset) { return line[(size_t) ((pos - whole - offset) & mask)]; };
+        const float x0 = tap(-1), x1 = tap(0), x2 = tap(1), x3 = tap(2);
+
+        const float c0 = -d * (d - 1.0f) * (d - 2.0f) / 6.0f;
+        const float c1 = (d + 1.0f) * (d - 1.0f) * (d - 2.0f) / 2.0f;
+        const float c2 = -(d + 1.0f) * d * (d - 2.0f) / 2.0f;
+        const float c3 = (d + 1.0f) * d * (d - 1.0f) / 6.0f;
+        return c0 * x0 + c1 * x1 + c2 * x2 + c3 * x3;
+    }
+
+    /*=================================================================================*/
+
+    static constexpr int bufferSize = 256;
+    static constexpr int mask = bufferSize - 1;
+
+    std::vector<float> lines[2];
+    float current[2] = {0, 0};
+    float target[2] = {0, 0};
+    int writePos = 0;
+    bool running = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (InterauralDelay)
+};
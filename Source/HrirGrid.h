@@ -0,0 +1,240 @@
+/*==============================================================================
+//                      HRIR Grid
+//      Measured and interpolated HRIRs in one flat set, ready to pack
+//==============================================================================
+// - Shared by the app and the offline grid generator, so a shipped grid and
+//   one built at startup come from the same code.
+// - A CIPIC subject is read as the full measured sphere. The horizontal
+//   planes are then resampled from its triangulation at any azimuth step.
+// - Taps live in one contiguous block, two ears per entry. The block is
+//   sized before the planes are filled, so the fill runs on a pool without
+//   any locking.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "HrirPack.h"
+#include "HrtfSphere.h"
+
+//==============================================================================
+//              HRIR Grid
+//
+//==============================================================================
+
+class HrirGrid {
+public:
+    static constexpr int impulseLength = 200;
+    //CIPIC files hold one polar angle per sample
+    static constexpr float cipicFirstPolar = -45.0f;
+    static constexpr float cipicPolarStep = 5.625f;
+
+    //Pack groups, the app restores each into its own plane
+    enum Group {
+        zeroPlaneGroup = 0,
+        plusSixGroup,
+        minusSixGroup,
+        sphereGroup
+    };
+
+    //One lateral angle of a CIPIC subject, <lateral>az or neg<lateral>az left/right.wav
+    struct CipicColumn {
+        File left;
+        File right;
+        float lateral;
+    };
+
+    HrirGrid() {}
+
+    /*=================================================================================*/
+
+    void clear() {
+        entries.clear();
+        taps.clear();
+        sphereEntries.clear();
+    }
+
+    int add(float azimuth, float elevation, int group, const float *left, const float *right) {
+        const int index = allocate(azimuth, elevation, group);
+        std::copy(left, left + impulseLength, getTaps(index, 0));
+        std::copy(right, right + impulseLength, getTaps(index, 1));
+        return index;
+    }
+
+    /*=================================================================================*/
+
+    //Every polar row of one lateral angle, taps in the channels and a sample per row
+    void addCipicColumn(const AudioSampleBuffer &left, const AudioSampleBuffer &right, float lateral) {
+        const int length = jmin(impulseLength, left.getNumChannels(), right.getNumChannels());
+        const int numPolar = jmin(left.getNumSamples(), right.getNumSamples());
+
+        for (int row = 0; row < numPolar; ++row) {
+            float azimuth, elevation;
+            HrtfSphere::interauralToVertical(lateral, cipicFirstPolar + cipicPolarStep * row, azimuth, elevation);
+            const int index = allocate(azimuth, elevation, sphereGroup);
+            for (int tap = 0; tap < length; ++tap) {
+                getTaps(index, 0)[tap] = left.getSample(tap, row);
+                getTaps(index, 1)[tap] = right.getSample(tap, row);
+            }
+        }
+    }
+
+    //The lateral angles of a subject folder from left to right, so the sphere's entries come
+    //out in the same order whoever reads the files
+    static std::vector<CipicColumn> findCipicColumns(const File &directory) {
+        std::vector<CipicColumn> columns;
+        for (auto &file : directory.findChildFiles(File::findFiles, false, "*azleft.wav")) {
+            auto name = file.getFileNameWithoutExtension();
+            const bool negative = name.startsWith("neg");
+            const float lateral = (float) (negative ? name.substring(3) : name).getIntValue();
+            columns.push_back({file, file.getSiblingFile(name.replace("azleft", "azright") + ".wav"),
+                               negative ? -lateral : lateral});
+        }
+        std::sort(columns.begin(), columns.end(),
+                  [](const CipicColumn &a, const CipicColumn &b) { return a.lateral < b.lateral; });
+        return columns;
+    }
+
+    //Reads every column of a subject folder. Returns the number of lateral angles found.
+    //Not real-time safe.
+    int loadCipicSubject(const File &directory, AudioFormatManager &formatManager) {
+        int numColumns = 0;
+        for (auto &column : findCipicColumns(directory)) {
+            AudioSampleBuffer left, right;
+            if (read(formatManager, column.left, left) && read(formatManager, column.right, right)) {
+                addCipicColumn(left, right, column.lateral);
+                ++numColumns;
+            }
+        }
+        return numColumns;
+    }
+
+    /*=================================================================================*/
+
+    //Adds the sphere group's directions to sphere in entry order and remembers which entry
+    //each one came from, so gain indices map back to taps
+    bool buildSphere(HrtfSphere &sphere) {
+        sphere.clear();
+        sphereEntries.clear();
+        for (int i = 0; i < size(); ++i) {
+            if (entries[(size_t) i].group == sphereGroup) {
+                sphere.addDirection(entries[(size_t) i].azimuth, entries[(size_t) i].elevation);
+                sphereEntries.push_back(i);
+            }
+        }
+        return sphere.build();
+    }
+
+    //The three horizontal planes every azimuthStep degrees, each HRIR the VBAP blend of the
+    //measured ones around it. The planes are split into one azimuth range per pool thread,
+    //the call waits for all of them. Do not call from a job on the same pool.
+    void addPlanes(const HrtfSphere &sphere, float azimuthStep, ThreadPool &pool) {
+        jassert(sphere.isBuilt() && azimuthStep > 0);
+        const int numAzimuths = jmax(1, roundToInt(360.0f / azimuthStep));
+        const std::pair<int, float> planes[] = {{zeroPlaneGroup, 0.0f}, {plusSixGroup, 6.0f}, {minusSixGroup, -6.0f}};
+
+        std::vector<int> firstIndices;
+        for (auto &plane : planes) {
+            firstIndices.push_back(size());
+            for (int a = 0; a < numAzimuths; ++a)
+                allocate(a * azimuthStep, plane.second, plane.first);
+        }
+
+        const int rangesPerPlane = jlimit(1, numAzimuths, (pool.getNumThreads() + 2) / 3);
+        const int rangeSize = (numAzimuths + rangesPerPlane - 1) / rangesPerPlane;
+        std::vector<Range<int>> ranges;
+        for (auto first : firstIndices)
+            for (int start = 0; start < numAzimuths; start += rangeSize)
+                ranges.push_back({first + start, first + jmin(numAzimuths, start + rangeSize)});
+
+        std::atomic<int> remaining { (int) ranges.size() };
+        WaitableEvent finished;
+        for (auto range : ranges) {
+            pool.addJob([this, &sphere, &remaining, &finished, range] {
+                for (int index = range.getStart(); index < range.getEnd(); ++index) {
+                    auto &entry = entries[(size_t) index];
+                    interpolate(sphere, entry.azimuth, entry.elevation, getTaps(index, 0), getTaps(index, 1));
+                }
+                if (--remaining == 0)
+                    finished.signal();
+            });
+        }
+        finished.wait();
+    }
+
+    //VBAP blend of the measured HRIRs around the direction, buildSphere must have run
+    void interpolate(const HrtfSphere &sphere, float azimuth, float elevation, float *left, float *right) const {
+        int indices[3];
+        float weights[3];
+        const int count = sphere.getGains(azimuth, elevation, indices, weights);
+
+        FloatVectorOperations::clear(left, impulseLength);
+        FloatVectorOperations::clear(right, impulseLength);
+        for (int i = 0; i < count; ++i) {
+            const int source = sphereEntries[(size_t) indices[i]];
+            FloatVectorOperations::addWithMultiply(left, getTaps(source, 0), weights[i], impulseLength);
+            FloatVectorOperations::addWithMultiply(right, getTaps(source, 1), weights[i], impulseLength);
+        }
+    }
+
+    /*=================================================================================*/
+
+    //Pack sources sorted by group, planes first and the sphere last as the banks expect
+    std::vector<HrirPack::Source> getSources() const {
+        std::vector<HrirPack::Source> sources;
+        for (int i = 0; i < size(); ++i) {
+            auto &entry = entries[(size_t) i];
+            sources.push_back({entry.azimuth, entry.elevation, entry.group, getTaps(i, 0), getTaps(i, 1)});
+        }
+        std::stable_sort(sources.begin(), sources.end(),
+                         [](const HrirPack::Source &a, const HrirPack::Source &b) { return a.group < b.group; });
+        return sources;
+    }
+
+    /*=================================================================================*/
+
+    int size() const { return (int) entries.size(); }
+
+    float getAzimuth(int index) const { return entries[(size_t) index].azimuth; }
+
+    float getElevation(int index) const { return entries[(size_t) index].elevation; }
+
+    int getGroup(int index) const { return entries[(size_t) index].group; }
+
+    float *getTaps(int index, int ear) { return taps.data() + (size_t) (index * 2 + ear) * impulseLength; }
+
+    const float *getTaps(int index, int ear) const { return taps.data() + (size_t) (index * 2 + ear) * impulseLength; }
+
+private:
+    struct Entry {
+        float azimuth;
+        float elevation;
+        int group;
+    };
+
+    /*=================================================================================*/
+
+    //New zeroed entry. Moves the tap block, so never while a fill is running.
+    int allocate(float azimuth, float elevation, int group) {
+        azimuth = std::fmod(std::fmod(azimuth, 360.0f) + 360.0f, 360.0f);
+        entries.push_back({azimuth, elevation, group});
+        taps.resize(entries.size() * 2 * impulseLength, 0.0f);
+        return size() - 1;
+    }
+
+    static bool read(AudioFormatManager &formatManager, const File &file, AudioSampleBuffer &buffer) {
+        std::unique_ptr<AudioFormatReader> reader(formatManager.createReaderFor(file));
+        if (reader == nullptr)
+            return false;
+        buffer.setSize((int) reader->numChannels, (int) reader->lengthInSamples);
+        return reader->read(&buffer, 0, (int) reader->lengthInSamples, 0, true, true);
+    }
+
+    /*=================================================================================*/
+
+    std::vector<Entry> entries;
+    std::vector<float> taps;
+    std::vector<int> sphereEntries;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HrirGrid)
+};
@@ -0,0 +1,321 @@
+/*==============================================================================
+//                      HRIR Pack
+//      The whole processed HRIR set in one binary file, mapped at startup
+//==============================================================================
+// - Holds everything startup used to derive from the subject48 WAVs: the
+//   interpolated grid, raw and minimum phase taps, onsets and the
+//   partitioned spectra for one partition size.
+// - Every section starts on a 64 byte boundary, so the mapped floats can be
+//   handed straight to the SIMD kernels and banks.
+// - The header carries a version and the key of the sources it was built
+//   from, a pack that does not match is rebuilt rather than trusted.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "BinauralConvolver.h"
+#include "HrirDecomposition.h"
+
+//==============================================================================
+//              HRIR Pack
+//
+//==============================================================================
+
+class HrirPack {
+public:
+    //Bump when the layout or the processing behind it changes
+    static constexpr uint32 formatVersion = 2;
+    static constexpr int sectionAlignment = 64;
+
+    //One measured or interpolated direction. group is the caller's, e.g. the plane it
+    //belongs to, and comes back unchanged.
+    struct Source {
+        float azimuth;
+        float elevation;
+        int group;
+        const float *left;
+        const float *right;
+    };
+
+    HrirPack() {}
+
+    /*=================================================================================*/
+
+    static File getDefaultFileFor(uint64 key, int partitionSize) {
+        return File::getSpecialLocation(File::userApplicationDataDirectory)
+            .getChildFile("UnderPressure").getChildFile("HrirPacks")
+            .getChildFile(String::toHexString((int64) key) + "_" + String(partitionSize) + ".uphp");
+    }
+
+    /*=================================================================================*/
+
+    //Decomposes and FFTs every source, then writes the pack through a temporary file so a
+    //crash never leaves half of one behind. Not real-time safe.
+    static bool write(const File &file, uint64 key, int partitionSize, int impulseLength, int filterLength,
+                      const std::vector<Source> &sources) {
+        if (file.getParentDirectory().createDirectory().failed())
+            return false;
+
+        HRTFSpectrumBank rawSpectra, minPhaseSpectra;
+        rawSpectra.setPartitionSize(partitionSize, impulseLength);
+        minPhaseSpectra.setPartitionSize(partitionSize, impulseLength);
+        MinimumPhaseHrirSet minPhase;
+        minPhase.clear(filterLength);
+
+        for (auto &source : sources) {
+            rawSpectra.addImpulse(source.left, source.right, impulseLength);
+            auto index = minPhase.add(source.left, source.right, impulseLength);
+            minPhaseSpectra.addImpulse(minPhase.getFilter(index, MinimumPhaseHrirSet::left),
+                                       minPhase.getFilter(index, MinimumPhaseHrirSet::right), filterLength);
+        }
+
+        Header header {};
+        std::memcpy(header.magic, "UPHP", 4);
+        header.version = formatVersion;
+        header.key = key;
+        header.numEntries = (int32) sources.size();
+        header.impulseLength = impulseLength;
+        header.filterLength = filterLength;
+        header.partitionSize = partitionSize;
+        header.impulseStride = rawSpectra.getImpulseStride();
+
+        const auto numEntries = (uint64) sources.size();
+        uint64 offset = align(sizeof(Header));
+        auto nextSection = [&offset](uint64 numBytes) { auto start = offset; offset = align(offset + numBytes); return start; };
+        header.entryOffset = nextSection(sizeof(Entry) * numEntries);
+        header.tapOffset = nextSection(sizeof(float) * numEntries * 2 * (uint64) impulseLength);
+        header.filterOffset = nextSection(sizeof(float) * numEntries * 2 * (uint64) filterLength);
+        header.onsetOffset = nextSection(sizeof(float) * numEntries * 2);
+        header.spectraOffset = nextSection(sizeof(float) * numEntries * (uint64) header.impulseStride);
+        header.minPhaseSpectraOffset = nextSection(sizeof(float) * numEntries * (uint64) header.impulseStride);
+        header.totalSize = offset;
+
+        TemporaryFile temp(file);
+        {
+            FileOutputStream out(temp.getFile());
+            if (out.failedToOpen())
+                return false;
+
+            auto seek = [&out](uint64 position) {
+                while ((uint64) out.getPosition() < position)
+                    out.writeByte(0);
+            };
+            auto writeFloats = [&out](const float *data, int num) { out.write(data, sizeof(float) * (size_t) num); };
+
+            out.write(&header, sizeof(Header));
+
+            seek(header.entryOffset);
+            for (int i = 0; i < header.numEntries; ++i) {
+                Entry entry { sources[(size_t) i].azimuth, sources[(size_t) i].elevation, sources[(size_t) i].group,
+                              rawSpectra.getNumSegments(i), minPhaseSpectra.getNumSegments(i) };
+                out.write(&entry, sizeof(Entry));
+            }
+
+            seek(header.tapOffset);
+            for (auto &source : sources) {
+                writeFloats(source.left, impulseLength);
+                writeFloats(source.right, impulseLength);
+            }
+
+            seek(header.filterOffset);
+            for (int i = 0; i < header.numEntries; ++i) {
+                writeFloats(minPhase.getFilter(i, MinimumPhaseHrirSet::left), filterLength);
+                writeFloats(minPhase.getFilter(i, MinimumPhaseHrirSet::right), filterLength);
+            }
+
+            seek(header.onsetOffset);
+            for (int i = 0; i < header.numEntries; ++i) {
+                float onsets[2] = {minPhase.getOnset(i, MinimumPhaseHrirSet::left),
+                                   minPhase.getOnset(i, MinimumPhaseHrirSet::right)};
+                writeFloats(onsets, 2);
+            }
+
+            seek(header.spectraOffset);
+            for (int i = 0; i < header.numEntries; ++i)
+                writeFloats(rawSpectra.getImpulseSpectra(i), header.impulseStride);
+
+            seek(header.minPhaseSpectraOffset);
+            for (int i = 0; i < header.numEntries; ++i)
+                writeFloats(minPhaseSpectra.getImpulseSpectra(i), header.impulseStride);
+
+            seek(header.totalSize);
+            out.flush();
+            if (out.getStatus().failed())
+                return false;
+        }
+        return temp.overwriteTargetFileWithTemporary();
+    }
+
+    /*=================================================================================*/
+
+    //Maps the pack if it exists and matches the key and partition size. Nothing is copied,
+    //the accessors point into the mapping until close or the next open.
+    bool open(const File &file, uint64 key, int partitionSize) {
+        return map(file, true, key, partitionSize);
+    }
+
+    //Maps any valid pack whatever it was built from, e.g. the grid shipped with the app
+    bool open(const File &file) {
+        return map(file, false, 0, 0);
+    }
+
+    void close() {
+        mapping.reset();
+        data = nullptr;
+    }
+
+    bool isOpen() const { return data != nullptr; }
+
+    /*=================================================================================*/
+
+    uint64 getKey() const { return header.key; }
+
+    int size() const { return isOpen() ? header.numEntries : 0; }
+
+    int getImpulseLength() const { return header.impulseLength; }
+
+    int getFilterLength() const { return header.filterLength; }
+
+    int getPartitionSize() const { return header.partitionSize; }
+
+    int getImpulseStride() const { return header.impulseStride; }
+
+    /*=================================================================================*/
+
+    float getAzimuth(int index) const { return getEntry(index).azimuth; }
+
+    float getElevation(int index) const { return getEntry(index).elevation; }
+
+    int getGroup(int index) const { return getEntry(index).group; }
+
+    int getNumSegments(int index) const { return getEntry(index).numSegments; }
+
+    int getMinPhaseSegments(int index) const { return getEntry(index).minPhaseSegments; }
+
+    /*=================================================================================*/
+
+    const float *getTaps(int index, int ear) const {
+        return getFloats(header.tapOffset) + (size_t) (index * 2 + ear) * (size_t) header.impulseLength;
+    }
+
+    const float *getMinPhaseFilter(int index, int ear) const {
+        return getFloats(header.filterOffset) + (size_t) (index * 2 + ear) * (size_t) header.filterLength;
+    }
+
+    float getOnset(int index, int ear) const { return getFloats(header.onsetOffset)[index * 2 + ear]; }
+
+    //HRTFSpectrumBank layout, getImpulseStride floats per entry
+    const float *getSpectra(int index) const {
+        return getFloats(header.spectraOffset) + (size_t) index * (size_t) header.impulseStride;
+    }
+
+    const float *getMinPhaseSpectra(int index) const {
+        return getFloats(header.minPhaseSpectraOffset) + (size_t) index * (size_t) header.impulseStride;
+    }
+
+private:
+    //Sections follow in this order, each at the offset recorded here
+    struct Header {
+        char magic[4];
+        uint32 version;
+        uint64 key;
+        int32 numEntries;
+        int32 impulseLength;
+        int32 filterLength;
+        int32 partitionSize;
+        int32 impulseStride;
+        int32 reserved;
+        uint64 entryOffset;
+        uint64 tapOffset;
+        uint64 filterOffset;
+        uint64 onsetOffset;
+        uint64 spectraOffset;
+        uint64 minPhaseSpectraOffset;
+        uint64 totalSize;
+    };
+
+    struct Entry {
+        float azimuth;
+        float elevation;
+        int32 group;
+        int32 numSegments;
+        int32 minPhaseSegments;
+    };
+
+    bool map(const File &file, bool checkSource, uint64 key, int partitionSize) {
+        close();
+        if (!file.existsAsFile())
+            return false;
+
+        auto newMapping = std::make_unique<MemoryMappedFile>(file, MemoryMappedFile::readOnly);
+        if (newMapping->getData() == nullptr || newMapping->getSize() < sizeof(Header))
+            return false;
+
+        Header newHeader;
+        std::memcpy(&newHeader, newMapping->getData(), sizeof(Header));
+        if (std::memcmp(newHeader.magic, "UPHP", 4) != 0 || newHeader.version != formatVersion
+            || (checkSource && (newHeader.key != key || newHeader.partitionSize != partitionSize))
+            || newHeader.numEntries <= 0 || newHeader.impulseLength <= 0 || newHeader.filterLength <= 0
+            || newHeader.partitionSize <= 0 || !isPowerOfTwo(newHeader.partitionSize)
+            || newHeader.totalSize > (uint64) newMapping->getSize()
+            || !hasValidLayout(newHeader))
+            return false;
+
+        //Segment counts index into the spectra, they must stay within the stride
+        const int maxSegments = getNumSegmentsFor(newHeader);
+        auto *entries = reinterpret_cast<const Entry *>(static_cast<const char *>(newMapping->getData())
+                                                        + newHeader.entryOffset);
+        for (int i = 0; i < newHeader.numEntries; ++i)
+            if (entries[i].numSegments < 1 || entries[i].numSegments > maxSegments
+                || entries[i].minPhaseSegments < 1 || entries[i].minPhaseSegments > maxSegments)
+                return false;
+
+        mapping = std::move(newMapping);
+        header = newHeader;
+        data = static_cast<const char *>(mapping->getData());
+        return true;
+    }
+
+    static int getNumSegmentsFor(const Header &h) {
+        return (int) (((int64) h.impulseLength + h.partitionSize - 1) / h.partitionSize);
+    }
+
+    //Every section has to start aligned after the header and end within totalSize, and the
+    //stride has to be the one HRTFSpectrumBank uses for this partition layout. A pack that
+    //lies about either would have the accessors read past the mapping.
+    static bool hasValidLayout(const Header &h) {
+        const auto numEntries = (uint64) h.numEntries;
+        const auto expectedStride = (int64) (h.partitionSize + 1) * 2 * getNumSegmentsFor(h) * 2;
+        if (h.impulseStride <= 0 || h.impulseStride != expectedStride)
+            return false;
+
+        auto fits = [&h](uint64 offset, uint64 count, uint64 itemBytes) {
+            return offset >= sizeof(Header) && offset % sectionAlignment == 0 && offset <= h.totalSize
+                   && count <= (h.totalSize - offset) / itemBytes;
+        };
+        return fits(h.entryOffset, numEntries, sizeof(Entry))
+               && fits(h.tapOffset, numEntries * 2, sizeof(float) * (uint64) h.impulseLength)
+               && fits(h.filterOffset, numEntries * 2, sizeof(float) * (uint64) h.filterLength)
+               && fits(h.onsetOffset, numEntries * 2, sizeof(float))
+               && fits(h.spectraOffset, numEntries, sizeof(float) * (uint64) h.impulseStride)
+               && fits(h.minPhaseSpectraOffset, numEntries, sizeof(float) * (uint64) h.impulseStride);
+    }
+
+    static uint64 align(uint64 offset) {
+        return (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+    }
+
+    const Entry &getEntry(int index) const {
+        jassert(isPositiveAndBelow(index, size()));
+        return reinterpret_cast<const Entry *>(data + header.entryOffset)[index];
+    }
+
+    const float *getFloats(uint64 offset) const { return reinterpret_cast<const float *>(data + offset); }
+
+    std::unique_ptr<MemoryMappedFile> mapping;
+    Header header {};
+    const char *data = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HrirPack)
+};
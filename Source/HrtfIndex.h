@@ -0,0 +1,215 @@
+/*==============================================================================
+//                      HRTF Index
+//      Constant time direction lookups into the HRTF banks
+//==============================================================================
+// - Directions are quantised to a flat azimuth x elevation table, one row
+//   per elevation step padded to whole cache lines. Each cell holds the bank
+//   index of the entry exactly on it and of the entry nearest to it.
+// - Lookups return handles, plain bank indices, never HRIR copies.
+// - Entries at elevation 0 also form a ring sorted by azimuth with a per
+//   cell start position, for blending the two azimuths around a source.
+// - Nothing after build depends on how many entries there are.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "HrtfSphere.h"
+
+//==============================================================================
+//              HRTF Handle
+//              Index of an impulse in the spectrum and tap banks
+//==============================================================================
+
+struct HrtfHandle {
+    int index = -1;
+
+    bool isValid() const { return index >= 0; }
+};
+
+//==============================================================================
+//              HRTF Index
+//
+//==============================================================================
+
+class HrtfIndex {
+public:
+    static constexpr int cellsPerDegree = 1;
+    static constexpr int azimuthCells = 360 * cellsPerDegree;
+    static constexpr int elevationCells = 180 * cellsPerDegree + 1;
+    //Ints per row, rounded up to 64 bytes
+    static constexpr int rowStride = (azimuthCells + 15) & ~15;
+
+    HrtfIndex() {}
+
+    /*=================================================================================*/
+
+    void clear() {
+        entries.clear();
+        ringAzimuths.clear();
+        ringIndices.clear();
+        exactCells = nearestCells = nullptr;
+    }
+
+    //Degrees, azimuth wraps at 360 and elevation is -90..90
+    void add(float azimuth, float elevation, int bankIndex) {
+        entries.push_back({wrapAzimuth(azimuth), jlimit(-90.0f, 90.0f, elevation), bankIndex});
+    }
+
+    /*=================================================================================*/
+
+    //Fills both tables and the ring. Not real-time safe. Entries added earlier win ties, so
+    //measured directions should go in before duplicates of them.
+    void build() {
+        const size_t numCells = (size_t) rowStride * elevationCells;
+        storage.calloc(numCells * 2 * sizeof(int32) + 64);
+        exactCells = reinterpret_cast<int32 *>((reinterpret_cast<uintptr_t>(storage.get()) + 63) & ~(uintptr_t) 63);
+        nearestCells = exactCells + numCells;
+        std::fill(exactCells, exactCells + numCells, -1);
+        std::fill(nearestCells, nearestCells + numCells, -1);
+
+        std::vector<SphereVector> vectors;
+        for (auto &entry : entries) {
+            vectors.push_back(toVector(entry.azimuth, entry.elevation));
+
+            const float a = entry.azimuth * cellsPerDegree, e = (entry.elevation + 90.0f) * cellsPerDegree;
+            if (std::abs(a - std::round(a)) < 1.0e-3f && std::abs(e - std::round(e)) < 1.0e-3f) {
+                auto &cell = exactCells[getCell(roundToInt(a) % azimuthCells, roundToInt(e))];
+                if (cell < 0)
+                    cell = entry.bankIndex;
+            }
+        }
+
+        for (int e = 0; e < elevationCells && !entries.empty(); ++e) {
+            for (int a = 0; a < azimuthCells; ++a) {
+                auto v = toVector((float) a / cellsPerDegree, (float) e / cellsPerDegree - 90.0f);
+                size_t best = 0;
+                for (size_t i = 1; i < vectors.size(); ++i)
+                    if (vectors[i] * v > vectors[best] * v)
+                        best = i;
+                nearestCells[getCell(a, e)] = entries[best].bankIndex;
+            }
+        }
+
+        buildRing();
+    }
+
+    /*=================================================================================*/
+
+    //The entry exactly at this whole degree direction, invalid if there is none
+    HrtfHandle at(int azimuth, int elevation) const {
+        jassert(exactCells != nullptr);
+        if (!isPositiveAndNotGreaterThan(elevation + 90, 180))
+            return {};
+        return {exactCells[getCell(((azimuth % 360) + 360) % 360 * cellsPerDegree, (elevation + 90) * cellsPerDegree)]};
+    }
+
+    //The entry nearest to the table cell the direction rounds to, so at most half a cell
+    //off the true nearest neighbour
+    HrtfHandle findNearest(float azimuth, float elevation) const {
+        jassert(nearestCells != nullptr);
+        const int a = roundToInt(wrapAzimuth(azimuth) * cellsPerDegree) % azimuthCells;
+        const int e = roundToInt((jlimit(-90.0f, 90.0f, elevation) + 90.0f) * cellsPerDegree);
+        return {nearestCells[getCell(a, e)]};
+    }
+
+    /*=================================================================================*/
+
+    //The ring entries either side of azimuth and their linear weights, wrapping from the
+    //last entry back to the first. Returns how many bank indices were written, 0 to 2.
+    int findRingNeighbours(float azimuth, int *indices, float *weights) const {
+        const int count = (int) ringAzimuths.size();
+        if (count == 0)
+            return 0;
+
+        azimuth = wrapAzimuth(azimuth);
+        int lower = ringStarts[jmin(azimuthCells - 1, (int) (azimuth * cellsPerDegree))];
+        while (lower + 1 < count && ringAzimuths[(size_t) lower + 1] <= azimuth)
+            ++lower;
+
+        const float lowerAngle = lower >= 0 ? ringAzimuths[(size_t) lower] : ringAzimuths.back() - 360.0f;
+        const float upperAngle = lower + 1 < count ? ringAzimuths[(size_t) lower + 1] : ringAzimuths.front() + 360.0f;
+        lower = (lower + count) % count;
+        const int upper = (lower + 1) % count;
+
+        const float t = jlimit(0.0f, 1.0f, (azimuth - lowerAngle) / (upperAngle - lowerAngle));
+        indices[0] = ringIndices[(size_t) lower];
+        weights[0] = 1.0f - t;
+        if (t == 0.0f || lower == upper)
+            return 1;
+
+        indices[1] = ringIndices[(size_t) upper];
+        weights[1] = t;
+        return 2;
+    }
+
+    /*=================================================================================*/
+
+    int size() const { return (int) entries.size(); }
+
+    int getRingSize() const { return (int) ringAzimuths.size(); }
+
+private:
+    struct Entry {
+        float azimuth;
+        float elevation;
+        int bankIndex;
+    };
+
+    /*=================================================================================*/
+
+    static float wrapAzimuth(float azimuth) {
+        azimuth = std::fmod(azimuth, 360.0f);
+        return azimuth < 0 ? azimuth + 360.0f : (azimuth >= 360.0f ? 0.0f : azimuth);
+    }
+
+    static SphereVector toVector(float azimuth, float elevation) {
+        const double az = degreesToRadians((double) azimuth), el = degreesToRadians((double) elevation);
+        return {std::cos(el) * std::cos(az), std::cos(el) * std::sin(az), std::sin(el)};
+    }
+
+    static size_t getCell(int azimuthCell, int elevationCell) {
+        return (size_t) elevationCell * rowStride + (size_t) azimuthCell;
+    }
+
+    /*=================================================================================*/
+
+    //ringStarts holds, per azimuth cell, the last ring entry at or before the cell's start,
+    //-1 when the cell comes before the first entry
+    void buildRing() {
+        std::vector<Entry> ring;
+        for (auto &entry : entries)
+            if (entry.elevation == 0.0f)
+                ring.push_back(entry);
+        std::stable_sort(ring.begin(), ring.end(), [](const Entry &a, const Entry &b) { return a.azimuth < b.azimuth; });
+        ring.erase(std::unique(ring.begin(), ring.end(), [](const Entry &a, const Entry &b) { return a.azimuth == b.azimuth; }),
+                   ring.end());
+
+        ringAzimuths.clear();
+        ringIndices.clear();
+        for (auto &entry : ring) {
+            ringAzimuths.push_back(entry.azimuth);
+            ringIndices.push_back(entry.bankIndex);
+        }
+
+        int position = -1;
+        for (int a = 0; a < azimuthCells; ++a) {
+            while (position + 1 < (int) ring.size() && ring[(size_t) position + 1].azimuth <= (float) a / cellsPerDegree)
+                ++position;
+            ringStarts[(size_t) a] = position;
+        }
+    }
+
+    /*=================================================================================*/
+
+    std::vector<Entry> entries;
+    HeapBlock<char> storage;
+    int32 *exactCells = nullptr;
+    int32 *nearestCells = nullptr;
+
+    std::vector<float> ringAzimuths;
+    std::vector<int> ringIndices;
+    std::array<int, azimuthCells> ringStarts {};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HrtfIndex)
+};
@@ -0,0 +1,350 @@
+/*==============================================================================
+//                      HRTF Sphere
+//      Triangulated measurement sphere with constant time VBAP gain lookup
+//==============================================================================
+// - The convex hull of the measured directions is their spherical Delaunay
+//   triangulation. It is built once, with the inverse of every triangle's
+//   vertex matrix stored next to it.
+// - A 1 degree azimuth/elevation table holds the triangle around each cell
+//   centre. A lookup starts there and walks at most a few neighbours, so it
+//   costs the same wherever the source is.
+// - Gains are the VBAP weights of the three vertices, normalised to sum to 1
+//   so they can feed setHrtfBlend directly.
+// - Directions are azimuth 0..360 and elevation -90..90 in degrees, the same
+//   as the horizontal planes: azimuth 90 is the positive lateral side.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+//              Sphere Vector
+//              Just the 3D maths the sphere needs, ^ is the cross product
+//              and * the dot product
+//==============================================================================
+
+struct SphereVector {
+    double x = 0;
+    double y = 0;
+    double z = 0;
+
+    SphereVector operator-(const SphereVector &other) const { return {x - other.x, y - other.y, z - other.z}; }
+
+    SphereVector operator/(double divisor) const { return {x / divisor, y / divisor, z / divisor}; }
+
+    SphereVector operator^(const SphereVector &other) const {
+        return {y * other.z - z * other.y, z * other.x - x * other.z, x * other.y - y * other.x};
+    }
+
+    double operator*(const SphereVector &other) const { return x * other.x + y * other.y + z * other.z; }
+
+    double lengthSquared() const { return *this * *this; }
+};
+
+//==============================================================================
+//              HRTF Sphere
+//
+//==============================================================================
+
+class HrtfSphere {
+public:
+    //Lookup table resolution in degrees
+    static constexpr int cellsPerDegree = 1;
+    static constexpr int azimuthCells = 360 * cellsPerDegree;
+    static constexpr int elevationCells = 180 * cellsPerDegree + 1;
+    //Steps a lookup may walk away from the tabled triangle
+    static constexpr int maxWalkSteps = 4;
+
+    HrtfSphere() {}
+
+    /*=================================================================================*/
+
+    //CIPIC interaural-polar coordinates to the azimuth/elevation used everywhere else
+    static void interauralToVertical(float lateral, float polar, float &azimuth, float &elevation) {
+        auto v = interauralToVector(lateral, polar);
+        azimuth = (float) radiansToDegrees(std::atan2(v.y, v.x));
+        if (azimuth < 0)
+            azimuth += 360.0f;
+        elevation = (float) radiansToDegrees(std::asin(jlimit(-1.0, 1.0, v.z)));
+    }
+
+    /*=================================================================================*/
+
+    void clear() {
+        directions.clear();
+        triangles.clear();
+        cells.clear();
+    }
+
+    //Directions are numbered in the order they are added
+    int addDirection(float azimuth, float elevation) {
+        directions.push_back(toVector(azimuth, elevation));
+        return (int) directions.size() - 1;
+    }
+
+    /*=================================================================================*/
+
+    //Triangulates every direction added so far and fills the lookup table. Not real-time
+    //safe. Returns false when the directions do not surround the listener.
+    bool build() {
+        triangles.clear();
+        cells.clear();
+        if (!buildHull())
+            return false;
+
+        buildAdjacency();
+        for (auto &triangle : triangles)
+            invert(triangle);
+
+        cells.resize((size_t) (azimuthCells * elevationCells));
+        int triangle = 0;
+        for (int e = 0; e < elevationCells; ++e) {
+            for (int a = 0; a < azimuthCells; ++a) {
+                auto v = toVector((a + 0.5f) / cellsPerDegree, (float) e / cellsPerDegree - 90.0f);
+                triangle = walk(triangle, v, (int) triangles.size());
+                cells[(size_t) (e * azimuthCells + a)] = (uint16) triangle;
+            }
+        }
+        return true;
+    }
+
+    /*=================================================================================*/
+
+    //Real-time safe. Writes the direction indices and weights of the triangle around the
+    //direction and returns how many weights are non zero, 1 to 3.
+    int getGains(float azimuth, float elevation, int *indices, float *weights) const {
+        jassert(isBuilt());
+        azimuth = std::fmod(std::fmod(azimuth, 360.0f) + 360.0f, 360.0f);
+        elevation = jlimit(-90.0f, 90.0f, elevation);
+
+        const int a = jmin(azimuthCells - 1, (int) (azimuth * cellsPerDegree));
+        const int e = roundToInt((elevation + 90.0f) * cellsPerDegree);
+        const auto v = toVector(azimuth, elevation);
+        const auto &triangle = triangles[(size_t) walk(cells[(size_t) (e * azimuthCells + a)], v, maxWalkSteps)];
+
+        double gains[3];
+        triangle.getGains(v, gains);
+        double sum = 0;
+        for (auto &gain : gains)
+            sum += (gain = jmax(0.0, gain));
+
+        int count = 0;
+        for (int i = 0; i < 3; ++i) {
+            if (gains[i] > 0) {
+                indices[count] = triangle.vertices[i];
+                weights[count++] = (float) (gains[i] / sum);
+            }
+        }
+        if (count == 0) {
+            indices[count] = triangle.vertices[0];
+            weights[count++] = 1.0f;
+        }
+        return count;
+    }
+
+    /*=================================================================================*/
+
+    bool isBuilt() const { return !cells.empty(); }
+
+    int size() const { return (int) directions.size(); }
+
+    int getNumTriangles() const { return (int) triangles.size(); }
+
+private:
+    struct Triangle {
+        int vertices[3];
+        //Triangle across the edge opposite each vertex
+        int neighbours[3];
+        //Rows of the inverted vertex matrix, gains = direction * inverse
+        double inverse[3][3];
+
+        void getGains(const SphereVector &v, double *gains) const {
+            for (int j = 0; j < 3; ++j)
+                gains[j] = v.x * inverse[0][j] + v.y * inverse[1][j] + v.z * inverse[2][j];
+        }
+    };
+
+    /*=================================================================================*/
+
+    static SphereVector toVector(float azimuth, float elevation) {
+        const double az = degreesToRadians((double) azimuth), el = degreesToRadians((double) elevation);
+        return {std::cos(el) * std::cos(az), std::cos(el) * std::sin(az), std::sin(el)};
+    }
+
+    static SphereVector interauralToVector(float lateral, float polar) {
+        const double lat = degreesToRadians((double) lateral), pol = degreesToRadians((double) polar);
+        return {std::cos(lat) * std::cos(pol), std::sin(lat), std::cos(lat) * std::sin(pol)};
+    }
+
+    /*=================================================================================*/
+
+    //Follows the edge with the most negative gain until every gain is positive. Directions
+    //inside the hull always get there, maxSteps only bounds lookups from the table.
+    int walk(int triangle, const SphereVector &v, int maxSteps) const {
+        for (int step = 0; step < maxSteps; ++step) {
+            double gains[3];
+            triangles[(size_t) triangle].getGains(v, gains);
+
+            int worst = 0;
+            for (int i = 1; i < 3; ++i)
+                if (gains[i] < gains[worst])
+                    worst = i;
+
+            if (gains[worst] >= -insideTolerance)
+                break;
+            triangle = triangles[(size_t) triangle].neighbours[worst];
+        }
+        return triangle;
+    }
+
+    /*=================================================================================*/
+
+    //Incremental convex hull. Faces keep their vertices counter clockwise seen from outside.
+    bool buildHull() {
+        const int numPoints = (int) directions.size();
+        if (numPoints < 4)
+            return false;
+
+        //Starting tetrahedron from four well spread directions
+        int first[4] = {0, 0, 0, 0};
+        auto distance = [this](int a, int b) { return (directions[(size_t) a] - directions[(size_t) b]).lengthSquared(); };
+        for (int i = 1; i < numPoints; ++i)
+            if (distance(i, 0) > distance(first[1], 0))
+                first[1] = i;
+
+        double best = 0;
+        for (int i = 0; i < numPoints; ++i) {
+            auto area = ((directions[(size_t) first[1]] - directions[0]) ^ (directions[(size_t) i] - directions[0])).lengthSquared();
+            if (area > best) {
+                best = area;
+                first[2] = i;
+            }
+        }
+
+        best = 0;
+        for (int i = 0; i < numPoints; ++i) {
+            auto volume = std::abs(signedVolume(0, first[1], first[2], i));
+            if (volume > best) {
+                best = volume;
+                first[3] = i;
+            }
+        }
+        if (best < hullTolerance)
+            return false;
+
+        std::vector<Face> faces;
+        if (signedVolume(0, first[1], first[2], first[3]) > 0)
+            std::swap(first[1], first[2]);
+        faces.push_back(makeFace(0, first[1], first[2]));
+        faces.push_back(makeFace(0, first[3], first[1]));
+        faces.push_back(makeFace(0, first[2], first[3]));
+        faces.push_back(makeFace(first[1], first[3], first[2]));
+
+        std::map<std::pair<int, int>, int> edges;
+        std::vector<bool> visible;
+        for (int p = 0; p < numPoints; ++p) {
+            if (p == first[1] || p == first[2] || p == first[3] || p == 0)
+                continue;
+
+            const auto &point = directions[(size_t) p];
+            visible.assign(faces.size(), false);
+            bool any = false;
+            for (size_t f = 0; f < faces.size(); ++f) {
+                if (faces[f].alive && (faces[f].normal * point) - faces[f].offset > hullTolerance)
+                    any = visible[f] = true;
+            }
+            if (!any)
+                continue;
+
+            edges.clear();
+            for (size_t f = 0; f < faces.size(); ++f)
+                if (faces[f].alive)
+                    for (int k = 0; k < 3; ++k)
+                        edges[{faces[f].vertices[k], faces[f].vertices[(k + 1) % 3]}] = (int) f;
+
+            //Every edge of a visible face whose twin is hidden lies on the horizon
+            const size_t numFaces = faces.size();
+            for (size_t f = 0; f < numFaces; ++f) {
+                if (!visible[f])
+                    continue;
+                for (int k = 0; k < 3; ++k) {
+                    const int a = faces[f].vertices[k], b = faces[f].vertices[(k + 1) % 3];
+                    if (!visible[(size_t) edges[{b, a}]])
+                        faces.push_back(makeFace(a, b, p));
+                }
+                faces[f].alive = false;
+            }
+        }
+
+        for (auto &face : faces) {
+            if (face.alive) {
+                Triangle triangle;
+                std::copy(face.vertices, face.vertices + 3, triangle.vertices);
+                triangles.push_back(triangle);
+            }
+        }
+        return triangles.size() < (size_t) std::numeric_limits<uint16>::max();
+    }
+
+    /*=================================================================================*/
+
+    void buildAdjacency() {
+        std::map<std::pair<int, int>, int> edges;
+        for (size_t t = 0; t < triangles.size(); ++t)
+            for (int k = 0; k < 3; ++k)
+                edges[{triangles[t].vertices[k], triangles[t].vertices[(k + 1) % 3]}] = (int) t;
+
+        //The edge opposite vertex k runs from k + 1 to k + 2, its twin belongs to the neighbour
+        for (auto &triangle : triangles)
+            for (int k = 0; k < 3; ++k)
+                triangle.neighbours[k] = edges[{triangle.vertices[(k + 2) % 3], triangle.vertices[(k + 1) % 3]}];
+    }
+
+    void invert(Triangle &triangle) const {
+        const auto &a = directions[(size_t) triangle.vertices[0]];
+        const auto &b = directions[(size_t) triangle.vertices[1]];
+        const auto &c = directions[(size_t) triangle.vertices[2]];
+
+        //Columns of the inverse of the matrix with rows a, b, c
+        const auto bc = b ^ c, ca = c ^ a, ab = a ^ b;
+        const double det = a * bc;
+        const SphereVector columns[3] = {bc / det, ca / det, ab / det};
+        for (int j = 0; j < 3; ++j) {
+            triangle.inverse[0][j] = columns[j].x;
+            triangle.inverse[1][j] = columns[j].y;
+            triangle.inverse[2][j] = columns[j].z;
+        }
+    }
+
+    /*=================================================================================*/
+
+    struct Face {
+        int vertices[3];
+        SphereVector normal;
+        double offset;
+        bool alive;
+    };
+
+    Face makeFace(int a, int b, int c) const {
+        const auto &pa = directions[(size_t) a];
+        auto normal = (directions[(size_t) b] - pa) ^ (directions[(size_t) c] - pa);
+        return {{a, b, c}, normal, normal * pa, true};
+    }
+
+    double signedVolume(int a, int b, int c, int d) const {
+        const auto &pa = directions[(size_t) a];
+        return ((directions[(size_t) b] - pa) ^ (directions[(size_t) c] - pa)) * (directions[(size_t) d] - pa);
+    }
+
+    /*=================================================================================*/
+
+    static constexpr double hullTolerance = 1.0e-12;
+    static constexpr double insideTolerance = 1.0e-9;
+
+    std::vector<SphereVector> directions;
+    std::vector<Triangle> triangles;
+    std::vector<uint16> cells;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HrtfSphere)
+};
@@ -14,28 +14,45 @@
 
 #pragma once
 
+#include "BinauralConvolver.h"
+#include "FirConvolver.h"
+#include "HrirDecomposition.h"
+#include "AmbisonicsBus.h"
+#include "RenderCache.h"
+#include "SceneState.h"
+#include "StreamingVoice.h"
+#include "AssetIndex.h"
+#include "HrirPack.h"
+#include "HrirGrid.h"
+#include "HrtfSphere.h"
+#include "HrtfIndex.h"
+#include "StartupGraph.h"
+#include "CallbackMonitor.h"
+#include "RealtimeSafety.h"
+#include "AudioLog.h"
+#include "RouteSpline.h"
+#include "SourceStore.h"
+
 //Foward Decleration for typedef
 struct HRTFData;
 class ConProcessorLeft;
 class ConProcessorRight;
 class AudioPlayer;
 
-struct Node;
 //Typedefs for simpler objects
 typedef dsp::Matrix<double> Mat;
-typedef std::map<int, HRTFData> AzimuthInnerMap;
-typedef std::map<int, AzimuthInnerMap> AzimuthMap;
-AudioSampleBuffer rightZero;
-AudioSampleBuffer leftZero;
 //==============================================================================
 //                  Helper Functions
 //==============================================================================
 
-std::vector<int> azimuthAngles = {0, 5, 10, 15, 20, 25, 30, 35, 40, 45, 55, 65, 80, 90,
-                                  100, 115, 125, 135, 140, 145, 150, 155, 160, 165, 170, 175, 180,
-                                  185, 190, 195, 200, 205, 210, 215, 220, 225, 235, 245, 260, 270,
-                                  280, 295, 305, 315, 320, 325, 330, 335, 340, 345, 350, 355
-};
+//Diagnostics the audio thread sends through AudioLog, every argument is a double
+namespace AudioLogMessages {
+    const AudioLog::Message routeNode {AudioLog::route, "player %.0f reached node (%.2f, %.2f), azimuth %.1f"};
+    const AudioLog::Message convolutionBackend {AudioLog::rendering, "players switched to the %.0f backend (1 FIR, 0 FFT)"};
+    const AudioLog::Message renderMode {AudioLog::rendering, "render mode %.0f"};
+    const AudioLog::Message playerPinned {AudioLog::commands, "player %.0f pinned at (%.2f, %.2f)"};
+    const AudioLog::Message playerReleased {AudioLog::commands, "player %.0f released to its route"};
+}
 
 float decibelsToGain(float decibels){
     return  pow(10.0,decibels/20);
@@ -89,33 +106,6 @@ PositionSpherical vectorToSphere(Position pos){
     return posSphere;
 }
 
-struct Node{
-    std::shared_ptr<Node> next;
-    Position current;
-
-    Node(Position pos, std::shared_ptr<Node> next): current(pos), next(next){
-    }
-
-    Node(Position pos){
-        current = pos;
-    }
-
-};
-
-int findClosestHRTF(float azimuth){
-
-    int min = 0;
-    float minNum = abs(azimuth - azimuthAngles.at(0));
-    for(int i =0; i < azimuthAngles.size(); i++){
-        if( abs(azimuth - azimuthAngles.at(i)) < minNum)
-        {
-            min = i;
-            minNum = abs(azimuth - azimuthAngles.at(i));
-        }
-    }
-    return min;
-}
-
 //==============================================================================
 //              Audio Player Object
 //              Plays stationary sounds
@@ -128,6 +118,15 @@ struct AudioPlayer {
     int azimuth;
     int elevation;
     float gain;
+    //Gain the last mixed block ended on
+    float mixGain = 1;
+
+    //Only used when the scene is rendered through the Ambisonics bus
+    std::shared_ptr<AmbisonicEncoder> encoder;
+
+    //When set the clip is decoded from these mapped pages instead of buffer, and gain is
+    //applied on read. Owned by the AssetIndex.
+    MemoryMappedAudioFormatReader *mapped = nullptr;
 
     AudioPlayer():playHead(0), azimuth(0), elevation(0), gain(0){}
 
@@ -162,6 +161,17 @@ struct AudioPlayer {
         swap(first.elevation, second.elevation);
         swap(first.playHead, second.playHead);
         swap(first.gain, second.gain);
+        swap(first.mixGain, second.mixGain);
+        swap(first.encoder, second.encoder);
+        swap(first.mapped, second.mapped);
+    }
+
+    int getLength() const {
+        return mapped != nullptr ? (int) mapped->lengthInSamples : buffer.getNumSamples();
+    }
+
+    int getNumChannels() const {
+        return mapped != nullptr ? (int) mapped->numChannels : buffer.getNumChannels();
     }
 };
 
@@ -240,10 +250,8 @@ struct HRTFData {
     }
 //==============================================================================
 
-    static std::vector<HRTFData> SortByAzimuth(std::vector<HRTFData> data) {
-        std::vector<HRTFData> data_copy = data;
-        std::sort(data_copy.begin(), data_copy.end());
-        return data_copy;
+    static void sortByAzimuth(std::vector<HRTFData> &data) {
+        std::sort(data.begin(), data.end());
     }
 //==============================================================================
 
@@ -252,21 +260,6 @@ struct HRTFData {
     }
 //==============================================================================
 
-    static HRTFData &findByAzimuth(std::vector<HRTFData> &data, int az) {
-        std::vector<HRTFData>::iterator it;
-        HRTFData temp;
-        temp.azimuth = az;
-        it = std::find(data.begin(), data.end(), temp);
-        if (it != data.end()) {
-            std::cout << "Found::" << it->azimuth << " " << std::endl;
-            return *it;
-        } else {
-            std::cout << "Item not Found" << std::endl;
-            return *it;
-        }
-    }
-//==============================================================================
-
     void calculateRms() {
         rmsLeft = hrtfL.getRMSLevel(0, 0, 200);
         rmsRight = hrtfR.getRMSLevel(0, 0, 200);
@@ -287,86 +280,20 @@ struct HRTFData {
         std::cout << "Right RMS:  " << rmsRight << "\n";
         std::cout << "Left RMS: " << rmsLeft << "\n";
     }
-//==============================================================================
-
-    static void printMap(AzimuthMap mapHrtf) {
-
-        for (auto const &mapInner : mapHrtf) {
-            for (auto const &data : mapInner.second) {
-                std::cout << "--------------------------------\n";
-                std::cout << "Azimuth:" << data.second.azimuth << "\n";
-                std::cout << "Elevation:" << data.second.elevation << "\n";
-                std::cout << "Distance:" << data.second.distance << "\n";
-                std::cout << "Left RMS:" << data.second.rmsLeft << "\n";
-                std::cout << "Right RMS:" << data.second.rmsRight << "\n";
-            }
-        }
-    }
 };
 
 //==============================================================================
-//              Player Position Class
-//
+//              Player Voice
+//              Per player DSP state, where the player is lives in SourceStore
 //==============================================================================
-class Player{
-public:
-    Position currentPos;
-    Position nextPos;
-    std::shared_ptr<Node> route;
-    std::shared_ptr<Node> routeTail;
-    std::shared_ptr<Node> head;
-    float speed = 0;
-    float magnitude = 0;
-    Position direction;
-    AudioPlayer audioPlayer;
-    HRTFData bufferCurrent;
-
-    int hrtfIndex;
-    float gain = 1;
-    int steps;
-
-
-    Player():currentPos(Position()), nextPos(Position()), direction(Position()){
-        bufferCurrent.hrtfL = leftZero;
-        bufferCurrent.hrtfR = rightZero;
-        hrtfIndex = 0;
-
-
-    }
-
-    Position calculatePosition(float deltaTime){
-        Position position;
-        currentPos.x = currentPos.x + direction.x * (speed * deltaTime);
-        currentPos.y = currentPos.y + direction.y * (speed * deltaTime);
-
-    }
-
-    void calculateDirection(){
-        magnitude= sqrt(pow(currentPos.x,2) + pow(currentPos.y,2));
-        direction.x = (nextPos.x - currentPos.x) / magnitude;
-        direction.y = (nextPos.y - currentPos.y) / magnitude;
-    }
-
-    void printPosition(){
-        std::cout << "Current Pos:[" << currentPos.x << ","<< currentPos.y <<  "]\n";
-        std::cout << "Direction:[" << direction.x << ","<< direction.y <<  "]\n";
-    }
-
-    void buildRoute(Position start){
-        route =  std::make_shared<Node>(start, route);
-        head = route;
-        routeTail = route;
-        steps ++;
-    }
-
-    void addToRoute( Position pos){
-        std::shared_ptr<Node> temp = std::make_shared<Node>(pos);
-        routeTail->next = temp;
-        temp->next = route;
-        routeTail = temp;
-        steps++;
-    }
-
+//Each player owns its convolution state so players never share a delay line
+struct Player{
+    std::shared_ptr<BinauralConvolver> convolver;
+    std::shared_ptr<FirConvolver> firConvolver;
+    std::shared_ptr<InterauralDelay> interauralDelay;
+    std::shared_ptr<AmbisonicEncoder> encoder;
+    //Whether the delay lines ran in the last block, audio thread only
+    bool delayRunning = false;
 };
 //==============================================================================
 //                      Processors
@@ -545,13 +472,16 @@ class MainContentComponent : public AudioAppComponent,
                              public ChangeListener,
                              public Timer {
 public:
-    MainContentComponent()
+    //Without an audio device the component only renders when its owner calls
+    //getNextAudioBlock, e.g. the offline SceneRenderer
+    explicit MainContentComponent(bool openAudioDevice = true)
             : state(Stopped) {
 
-        setSize (600, 400);
+        setSize (600, 430);
 
         addAndMakeVisible(frequencySlider);
         frequencySlider.setRange(100, 5000, 100);
+        frequencySlider.onValueChange = [this] { publishScene(); };
         //frequencySlider.setTextValueSuffix(" Hz");
 
         addAndMakeVisible(azimuthSlider);
@@ -566,13 +496,40 @@ public:
         frequencyLabel.attachToComponent(&frequencySlider, true);
 
         addAndMakeVisible(durationSlider);
-        durationSlider.setRange(1, 10, 1);
+        durationSlider.setRange(1, maxPlayers, 1);
+        durationSlider.onValueChange = [this] { publishScene(); };
         //durationSlider.setTextValueSuffix(" seconds");
 
         addAndMakeVisible(durationLabel);
         durationLabel.setText("Number of players", dontSendNotification);
         durationLabel.attachToComponent(&durationSlider, true);
 
+        addAndMakeVisible(renderCostLabel);
+        renderCostLabel.setText("Per source: -", dontSendNotification);
+
+        addAndMakeVisible(backendBox);
+        backendBox.addItem("Auto (by block size)", backendAuto);
+        backendBox.addItem("FFT partitioned", backendFFT);
+        backendBox.addItem("FIR direct (" + FirConvolver::getKernelName() + ")", backendFIR);
+        backendBox.onChange = [this] { publishScene(); };
+        backendBox.setSelectedId(backendAuto, dontSendNotification);
+        backendLabel.setText("Convolution", dontSendNotification);
+        backendLabel.attachToComponent(&backendBox, true);
+
+        addAndMakeVisible(minimumPhaseToggle);
+        minimumPhaseToggle.setButtonText("Minimum phase + ITD");
+        minimumPhaseToggle.onClick = [this] { publishScene(); };
+
+        addAndMakeVisible(renderModeBox);
+        renderModeBox.addItem("Binaural per source", renderBinaural);
+        renderModeBox.addItem("Ambisonics, 1st order", renderAmbisonicsFirst);
+        renderModeBox.addItem("Ambisonics, 2nd order", renderAmbisonicsSecond);
+        renderModeBox.addItem("Ambisonics, 3rd order", renderAmbisonicsThird);
+        renderModeBox.onChange = [this] { publishScene(); };
+        renderModeBox.setSelectedId(renderBinaural, dontSendNotification);
+        renderModeLabel.setText("Rendering", dontSendNotification);
+        renderModeLabel.attachToComponent(&renderModeBox, true);
+
 //        addAndMakeVisible(homeButton);
 //        homeButton.setClickingTogglesState(true);
 //        homeLabel.setText("Home", dontSendNotification);
@@ -604,14 +561,36 @@ public:
         addAndMakeVisible(&currentPositionLabel);
         currentPositionLabel.setText("Stopped", dontSendNotification);
 
+        addAndMakeVisible(callbackLoadLabel);
+        callbackLoadLabel.setText("Load: -", dontSendNotification);
+
+        addAndMakeVisible(exportTimingButton);
+        exportTimingButton.setButtonText("Export timing");
+        exportTimingButton.onClick = [this] { exportTiming(); };
+
         formatManager.registerBasicFormats();
         formatManager1.registerBasicFormats();
 
+        //One scan of Resources for the whole session, WAVs are mapped rather than read
+        if (assets.build(formatManager))
+            std::cout << "Assets: " << assets.size() << " files, " << assets.getNumMapped() << " mapped\n";
+        else
+            std::cout << "Resources directory not found\n";
+
         transportSource = std::unique_ptr<AudioTransportSource>(new AudioTransportSource());
         transportSource.get()->addChangeListener(this);
 
-        setAudioChannels(0, 2);
-        startTimer(20);
+        RealtimeSafety::prepare();
+        audioLog.start();
+        ambience = std::make_unique<StreamingVoice>(streamingThread);
+        ambience->setReadInline(!openAudioDevice);
+        streamingThread.startThread();
+
+        publishScene();
+        if (openAudioDevice) {
+            setAudioChannels(0, 2);
+            startTimer(20);
+        }
 
     }
 
@@ -619,114 +598,188 @@ public:
 
     ~MainContentComponent() {
         shutdownAudio();
+
+        if (RealtimeSafety::getNumViolations() > 0) {
+            auto file = File::getSpecialLocation(File::userDocumentsDirectory)
+                    .getChildFile("UnderPressureRealtimeSafety.txt");
+            RealtimeSafety::writeReport(file);
+            std::cout << RealtimeSafety::getNumViolations() << " real-time safety violations, see "
+                      << file.getFullPathName() << "\n";
+        }
     }
 
     /*=================================================================================*/
 
     void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override {
         samplesExpected = samplesPerBlockExpected;
-        relativeTime1 = relativeTime1.milliseconds(0);
+        this->sampleRate = sampleRate;
 
-        //Set up of HRTF
-        loadFileToTransport();
-        impulseProcessing();
+        //Every load runs on the pool as soon as what it needs is there
+        StartupGraph startup;
+        const int partitionSize = getPartitionSizeFor(samplesPerBlockExpected);
 
-        loadPlayer("PlayerLoopMono.wav",one);
+        //Only the reader opens on the pool, the transport and the button are set up below
+        std::unique_ptr<AudioFormatReaderSource> transportFile;
+        startup.add("Transport", [this, &transportFile] { transportFile = openTransportFile(); });
 
-        //Extra Buffers
-        inputL = std::make_unique<AudioSampleBuffer>();
-        inputR = std::make_unique<AudioSampleBuffer>();
-
-        //Convolvers
-        convolutionProcessor = std::make_unique<ConvolutionProcessor>();
+        //Set up of HRTF, the WAVs are only touched when the pack has to be rebuilt
+        int hrirSet;
+        if (openHrirPack(partitionSize)) {
+            hrirSet = startup.add("Restore HRIR set from pack", [this] { restorePlanesFromPack(); });
+        } else {
+            std::vector<int> decodes;
+            for (auto &name : prepareHrirDecodes())
+                decodes.push_back(startup.add("Decode " + name, [this, name] { decodeHrir(name); }));
 
-        convolutionProcessor->irBufferLeft = zeroPlane.at(0).hrtfL;
-        convolutionProcessor->irBufferRight = zeroPlane.at(0).hrtfR;
-        convolutionProcessor->prepareToPlay(sampleRate, samplesPerBlockExpected);
+            auto grid = startup.add("Build HRIR grid", [this] { buildHrirGrid(); }, decodes);
+            hrirSet = startup.add("Write HRIR pack", [this, partitionSize] { writeHrirPack(partitionSize); }, {grid});
+        }
 
-        //-----------Effects chaing prepare to play-----------------
-        filter.prepareToPlay(sampleRate, samplesPerBlockExpected);
+        auto banks = startup.add("HRTF banks", [this, samplesPerBlockExpected] { buildHrtfBanks(samplesPerBlockExpected); },
+                                 {hrirSet});
+        for (int order = 1; order <= SphericalHarmonics::maxOrder; ++order)
+            startup.add("Ambisonic decoder order " + String(order), [this, order, samplesPerBlockExpected] {
+                ambisonicDecoders[order - 1].prepare(order, hrtfBank.getPartitionSize(), samplesPerBlockExpected);
+            }, {banks});
+        auto index = startup.add("Plane index", [this] { buildPlaneIndex(); }, {banks});
+        startup.add("Players", [this] { loadPlayers("PlayerLoopMono.wav", maxPlayers); }, {banks});
 
         //----------Add sounds to the Audio List-----------------------
         //-------------Place Static Sounds here---------------
-        loadAudioFile("CrowdDrumLoop.wav", 0.05f);
-        placeSound(65, audioList.at(0).buffer);
-        loadAudioFile("CrowdMediumClapping.wav", 0.05f);
-        placeSound(30, audioList.at(1).buffer);
+        audioList.clear();
+        audioList.resize(staticSounds.size());
+        for (int i = 0; i < (int) staticSounds.size(); ++i) {
+            String fileName = staticSounds[(size_t) i].fileName;
+            startup.add("Spatialise " + fileName, [this, i, fileName, sampleRate] {
+                placeSound(staticSounds[(size_t) i].azimuth, audioList[(size_t) i], fileName, staticSoundGain, sampleRate);
+            }, {index});
+        }
+
+        //-------------Streamed beds, only the read-ahead is decoded here---------------
+        startup.add("Streamed beds", [this, samplesPerBlockExpected] {
+            if (!ambience->open(assets.createReader("CrowdMediumChatting.wav"), samplesPerBlockExpected))
+                std::cout << "Could not open the streamed crowd bed\n";
+        });
+
+        startup.run();
+        decodedHrirs.clear();
+        hrirGrid.clear();
+        std::cout << startup.getReport();
+        loadFileToTransport(std::move(transportFile));
+
+        //Preallocate so the audio thread never resizes
+        voiceScratch.setSize(2, samplesPerBlockExpected);
+
+        //-----------Effects chaing prepare to play-----------------
+        filter.prepareToPlay(sampleRate, samplesPerBlockExpected);
 
         std::cout << "prepare to play called\n";
     }
 /*=====================Main Buffer Loop============================================*/
     //Buffer to fill
     void getNextAudioBlock(const AudioSourceChannelInfo &bufferToFill) override {
+        RealtimeSafety::ScopedRealtimeThread realtime;
+        callbackMonitor.beginCallback();
+        renderScene(bufferToFill);
+        callbackMonitor.endCallback(bufferToFill.numSamples, sampleRate);
+    }
 
-        if (true){
-
-            if (readerSource.get() == nullptr) {
-                bufferToFill.clearActiveBufferRegion();
-                return;
-            }
+    void renderScene(const AudioSourceChannelInfo &bufferToFill) {
 
-            if (state == Stopped){
-                bufferToFill.buffer->clear();
-            }
-            //----Add Dynamic Sound Here-------------------
-            if (state == Playing) {
-//            addAudioBuffers(&bufferToFill, players.at(0).audioPlayer);
-//            applyConvolutionSlider(&bufferToFill);
-
-                followRoute(players.at(0));
-                addAudioBuffers(&bufferToFill, players.at(0).audioPlayer);
-                applyConvolutionPlayer(&bufferToFill,players.at(0));
-            }
+        //Widgets are never read here, only the newest published scene
+        scene = sceneSnapshot.acquire();
+        guiCommands.drain([this](const SceneCommand &command) { applyCommand(command); });
 
-            //----Add Static Sound -------------------
-            if (state == Playing) {
-                if (frequencySlider.getValue() > 100) {
-                    addAudioBuffers(&bufferToFill, audioList.at(0));
-                    addAudioBuffers(&bufferToFill, audioList.at(1));
-                }
-                if (frequencySlider.getValue() > 1000) {
-                }
-                if (frequencySlider.getValue() > 3000) {
-                    //addAudioBuffers(&bufferToFill, audioList.at(2));
-                }
-                if (durationSlider.getValue() > 1){
+        if (readerSource.get() == nullptr) {
+            bufferToFill.clearActiveBufferRegion();
+            return;
+        }
 
-                }
-                if (durationSlider.getValue() > 2){
+        if (!scene.playing){
+            bufferToFill.buffer->clear();
+            ambience->stop();
+            sceneClock = 0;
+        } else {
+            sceneClock += bufferToFill.numSamples;
+        }
+        sceneSamples.store(sceneClock);
+        if (scene.renderMode != activeRenderMode)
+            startRenderMode(scene.renderMode);
+
+        //----Ambisonics: players and static sounds share one bus and one decode-----
+        if (scene.playing && activeRenderMode != renderBinaural) {
+            renderAmbisonics(bufferToFill, scene.numPlayers, activeRenderMode - renderBinaural,
+                             scene.crowdSize > 100);
+            auto mixTicks = Time::getHighResolutionTicks();
+            mixAmbience(bufferToFill);
+            callbackMonitor.addStageTicks(CallbackMonitor::mix, Time::getHighResolutionTicks() - mixTicks);
+            return;
+        }
 
-                }
+        //----Add Dynamic Sound Here-------------------
+        if (scene.playing)
+            renderPlayers(bufferToFill, scene.numPlayers);
 
+        //----Add Static Sound -------------------
+        if (scene.playing) {
+            auto mixTicks = Time::getHighResolutionTicks();
+            if (scene.crowdSize > 100) {
+                mixLoop(bufferToFill, audioList.at(0), 1.0f);
+                mixLoop(bufferToFill, audioList.at(1), 1.0f);
+            }
+            mixAmbience(bufferToFill);
+            callbackMonitor.addStageTicks(CallbackMonitor::mix, Time::getHighResolutionTicks() - mixTicks);
+            if (scene.crowdSize > 3000) {
+                //mixLoop(bufferToFill, audioList.at(2), 1.0f);
             }
-
         }
-
     }
 
     /*=================================================================================*/
-    void addAudioBuffers(const AudioSourceChannelInfo *source, AudioPlayer &toAdd) {
-        inputL->setSize(1, source->numSamples);
-        inputR->setSize(1, source->numSamples);
-
-        for (int i = 0; i < source->numSamples; ++i) {
-            inputL->setSample(0, i, source->buffer->getSample(0, i) + toAdd.buffer.getSample(0, toAdd.playHead));
-            inputR->setSample(0, i, source->buffer->getSample(1, i) + toAdd.buffer.getSample(1, toAdd.playHead++));
-            toAdd.playHead %= toAdd.buffer.getNumSamples();
-        }
+    //Adds the looped binaural stem straight into the output, in at most two spans per block.
+    //The gain ramps from where the previous block ended, a steady gain is a plain multiply-add.
+    void mixLoop(const AudioSourceChannelInfo &bufferToFill, AudioPlayer &source, float gain) {
+        const int length = source.convolvedBuffer.getNumSamples();
+        const int numSamples = bufferToFill.numSamples;
+        if (length == 0 || numSamples == 0)
+            return;
 
-        //Reset input buffer to original state
-        float *buffLeft = source->buffer->getWritePointer(0, source->startSample);
-        for (int i = 0; i < source->numSamples; ++i) {
-            buffLeft[i] = inputL->getSample(0, i);
-            //buffLeft[i] = 0;
+        const float startGain = source.mixGain;
+        const float step = (gain - startGain) / (float) numSamples;
+
+        for (int done = 0; done < numSamples;) {
+            int num = jmin(numSamples - done, length - source.playHead);
+            float from = startGain + step * (float) done;
+            float to = startGain + step * (float) (done + num);
+
+            for (int channel = 0; channel < 2; ++channel) {
+                const float *stem = source.convolvedBuffer.getReadPointer(channel, source.playHead);
+                if (from == to)
+                    FloatVectorOperations::addWithMultiply(
+                            bufferToFill.buffer->getWritePointer(channel, bufferToFill.startSample + done), stem, from,
+                            num);
+                else
+                    bufferToFill.buffer->addFromWithRamp(channel, bufferToFill.startSample + done, stem, num, from,
+                                                         to);
+            }
+            source.playHead = (source.playHead + num) % length;
+            done += num;
         }
+        source.mixGain = gain;
+    }
 
-        float *buffRight = source->buffer->getWritePointer(1, source->startSample);
-        for (int i = 0; i < source->numSamples; ++i) {
-            buffRight[i] = inputR->getSample(0, i);
-            //buffRight[i] = 0;
+    /*=================================================================================*/
+
+    //The streamed bed is diffuse stereo and skips both spatialisers. It restarts from the top
+    //whenever the crowd size crosses the threshold again.
+    void mixAmbience(const AudioSourceChannelInfo &bufferToFill) {
+        if (scene.crowdSize <= 1000) {
+            ambience->stop();
+            return;
         }
+        if (!ambience->isPlaying())
+            ambience->trigger();
+        ambience->addTo(*bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples, ambienceGain);
     }
 
 /*=================================================================================*/
@@ -753,88 +806,331 @@ public:
 
     /*=================================================================================*/
 
-    AudioSampleBuffer placeSound(int index, AudioSampleBuffer &inputBuffer) {
-        convolutionProcessor->irBufferLeft = zeroPlane.at(index).hrtfL;
-        convolutionProcessor->irBufferRight = zeroPlane.at(index).hrtfR;
+    //The binaural stem goes to convolvedBuffer, the dry clip is kept for the Ambisonics bus.
+    //Stems are cached on disk under a key of everything the convolution depends on. On a hit
+    //a mappable clip is never decoded, the Ambisonics bus reads it from its mapped pages.
+    void placeSound(float azimuth, AudioPlayer &sound, const String &fileName, float gain, double rate) {
+        const int index = planeIndex.findNearest(azimuth, 0).index;
+        auto &hrtf = zeroPlane.at((size_t) index);
+        sound.azimuth = hrtf.azimuth;
+        sound.elevation = hrtf.elevation;
+        sound.encoder = std::make_shared<AmbisonicEncoder>();
+
+        const int hrirLength = jmin(200, hrtf.hrtfL.getNumSamples());
+        const File source = getResourceFile(fileName);
+        auto key = RenderCache::Key().add(source)
+                                     .add(hrtf.hrtfL.getReadPointer(0), hrirLength)
+                                     .add(hrtf.hrtfR.getReadPointer(0), hrirLength)
+                                     .add(hrtf.azimuth).add(hrtf.elevation)
+                                     .add((double) gain).add(rate).getValue();
+
+        sound.gain = gain;
+        sound.playHead = 0;
+        sound.mapped = assets.getMapped(fileName);
+        int64 length = 0;
+        if (sound.mapped != nullptr)
+            length = sound.mapped->lengthInSamples;
+        else if (auto reader = assets.createReader(fileName))
+            length = reader->lengthInSamples;
+
+        if (renderCache.load(key, sound.convolvedBuffer, (int) length)) {
+            if (sound.mapped == nullptr)
+                sound.buffer = loadAudioFileToBuffer(fileName, gain);
+            std::cout << "Cached stem loaded: " << fileName << "\n";
+            return;
+        }
+
+        sound.buffer = loadAudioFileToBuffer(fileName, gain);
+        sound.convolvedBuffer.makeCopyOf(sound.buffer);
+        BinauralConvolver staticConvolver;
+        staticConvolver.prepare(hrtfBank, false);
+        staticConvolver.setHrtf(index);
+        staticConvolver.processBlock(sound.convolvedBuffer);
 
-        convolutionProcessor->prepareToPlay(sampleRate, inputBuffer.getNumSamples());
-        convolutionProcessor->processBlock(inputBuffer,emptyMidi);
-        return inputBuffer;
+        if (!renderCache.store(key, sound.convolvedBuffer, rate))
+            std::cout << "Could not cache stem in " << renderCache.getDirectory().getFullPathName() << "\n";
+        if (sound.mapped != nullptr)
+            sound.buffer.setSize(0, 0);
     }
 
     /*=================================================================================*/
 
-    void applyConvolutionSlider(const AudioSourceChannelInfo *buffer) {
-        //Get a preprocessed verstion stored called inputL and inputR
+    //Every active player is rendered on its own into voiceScratch through its own convolver,
+    //then summed into the output bus with its distance gain
+    void renderPlayers(const AudioSourceChannelInfo &bufferToFill, int numActive) {
+        numActive = jmin(numActive, (int) players.size());
+        auto startTicks = Time::getHighResolutionTicks();
+
+        //The backend that was idle has stale history, start it from silence
+        auto backend = scene.convolutionBackend;
+        bool fir = backend == backendFIR || (backend == backendAuto && samplesExpected <= firAutoMaxBlockSize);
+        if (fir != useFirBackend) {
+            for (auto &player : players)
+                fir ? player.firConvolver->reset() : player.convolver->reset();
+            useFirBackend = fir;
+            renderedWithFir.store(fir);
+            audioLog.log(AudioLogMessages::convolutionBackend, fir ? 1.0 : 0.0);
+        }
 
-        if (state == Stopped)
-            return;
+        //The FFT convolver only switches HRTF at partition boundaries, updating it more often
+        //would only add transforms of the partial block
+        int interval = scene.controlInterval;
+        if (!fir)
+            interval = jmax(interval, hrtfBank.getPartitionSize());
+
+        int64 routeTicks = 0, convolutionTicks = 0, mixTicks = 0;
+
+        //Each sub-block moves every player to where it is at its end, renders with that
+        //HRIR and ramps the gain there. voiceScratch also caps the sub-block size.
+        for (int done = 0; done < bufferToFill.numSamples;) {
+            int num = jmin(bufferToFill.numSamples - done, voiceScratch.getNumSamples(), interval);
+            auto ticks = Time::getHighResolutionTicks();
+            moveSources(numActive, num);
+            routeTicks += Time::getHighResolutionTicks() - ticks;
+
+            for (int i = 0; i < numActive; ++i) {
+                auto rendering = Time::getHighResolutionTicks();
+                renderPlayer(i, num);
+                auto rendered = Time::getHighResolutionTicks();
+
+                auto gain = sources.gain[(size_t) i] * sources.trim[(size_t) i];
+                auto &mixGain = sources.mixGain[(size_t) i];
+                for (int channel = 0; channel < 2; ++channel)
+                    bufferToFill.buffer->addFromWithRamp(channel, bufferToFill.startSample + done,
+                                                         voiceScratch.getReadPointer(channel), num, mixGain, gain);
+                mixGain = gain;
+
+                convolutionTicks += rendered - rendering;
+                mixTicks += Time::getHighResolutionTicks() - rendered;
+            }
+            done += num;
+        }
+        callbackMonitor.addStageTicks(CallbackMonitor::route, routeTicks);
+        callbackMonitor.addStageTicks(CallbackMonitor::convolution, convolutionTicks);
+        callbackMonitor.addStageTicks(CallbackMonitor::mix, mixTicks);
+
+        if (numActive > 0) {
+            auto seconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks);
+            renderSecondsPerSource.store(seconds / numActive);
+            renderedSources.store(numActive);
+            renderedOrder.store(0);
+        }
+    }
 
-        convolutionProcessor->processBlock(*buffer->buffer,emptyMidi);
-        (relativeTime += relativeTime.milliseconds(10)).inMilliseconds();
-        if (azimuthSlider.getValue()/5 != lastAzimuthPos) {
-            std::cout << "Approximate Azimuth Angle: " << zeroPlane.at(azimuthSlider.getValue()/5).azimuth << "\n";
-            degrees += 5;
-            relativeTime = relativeTime.milliseconds(0);
+    /*=================================================================================*/
 
+    //Copies the looped clip into the first channel of dest, wrapping at most once per span.
+    //Stereo clips are folded to mono when foldToMono is set, otherwise only the first channel
+    //is read. Mapped clips are decoded from their pages and may also write the second channel.
+    //A clip that failed to load or is empty reads as silence.
+    void readLoop(AudioPlayer &source, AudioSampleBuffer &dest, int numSamples, bool foldToMono) {
+        readLoop(source, source.playHead, dest, numSamples, foldToMono);
+    }
+
+    //The same for a clip shared by several sources, each with its own play head
+    void readLoop(const AudioPlayer &source, int &playHead, AudioSampleBuffer &dest, int numSamples, bool foldToMono) {
+        const int length = source.getLength();
+        const bool fold = foldToMono && source.getNumChannels() > 1;
+        float *mono = dest.getWritePointer(0);
+        if (length <= 0) {
+            FloatVectorOperations::clear(mono, numSamples);
+            return;
+        }
 
-            //Write new hrir for convolution at new angle
-            float *irWriteLeft = convolutionProcessor->irBufferLeft.getWritePointer(0);
-            float *irWriteRight = convolutionProcessor->irBufferRight.getWritePointer(0);
-            for (int i = 0; i < 200; i++) {
-                irWriteLeft[i] = zeroPlane.at(azimuthSlider.getValue() / 5).hrtfL.getSample(0, i);
-                irWriteRight[i] = zeroPlane.at(azimuthSlider.getValue() / 5).hrtfR.getSample(0, i);
+        for (int done = 0; done < numSamples;) {
+            int num = jmin(numSamples - done, length - playHead);
+            if (source.mapped != nullptr) {
+                source.mapped->read(&dest, done, num, playHead, true, fold);
+                if (fold) {
+                    FloatVectorOperations::add(mono + done, dest.getReadPointer(1, done), num);
+                    FloatVectorOperations::multiply(mono + done, 0.5f * source.gain, num);
+                } else {
+                    FloatVectorOperations::multiply(mono + done, source.gain, num);
+                }
+            } else if (fold) {
+                FloatVectorOperations::add(mono + done, source.buffer.getReadPointer(0, playHead),
+                                           source.buffer.getReadPointer(1, playHead), num);
+                FloatVectorOperations::multiply(mono + done, 0.5f, num);
+            } else {
+                FloatVectorOperations::copy(mono + done, source.buffer.getReadPointer(0, playHead), num);
             }
-            impulseIndex++;
+            playHead = (playHead + num) % length;
+            done += num;
+        }
+    }
+
+    /*=================================================================================*/
 
-            //Reset angle to 0
-            if (impulseIndex > zeroPlane.size() - 1) {
-                impulseIndex = 0;
-                degrees = 0;
+    void renderPlayer(int index, int numSamples) {
+        auto &player = players[(size_t) index];
+        const float azimuth = sources.azimuth[(size_t) index];
+        const float elevation = sources.elevation[(size_t) index];
+        float *mono = voiceScratch.getWritePointer(0);
+        readLoop(*sources.clips[(size_t) index], sources.playHeads[(size_t) index], voiceScratch, numSamples, false);
+
+        //The two measured azimuths around the player are blended, so the direction moves
+        //continuously instead of snapping to the nearest 5 degrees. Elevated players blend
+        //the three directions around them on the triangulated sphere instead.
+        int neighbours[3];
+        float weights[3];
+        int count = 0, bankOffset = 0;
+        if (elevation != 0.0f && hrtfSphere.isBuilt()) {
+            count = hrtfSphere.getGains(azimuth, elevation, neighbours, weights);
+            bankOffset = sphereBankOffset;
+        } else {
+            count = planeIndex.findRingNeighbours(azimuth, neighbours, weights);
+        }
+        count = quantiseBlend(neighbours, weights, count);
+
+        //Summing raw HRIRs whose onsets differ comb filters, so any blend renders through the
+        //min-phase filters with interpolated onsets and raw HRIRs only play on a measurement.
+        //The min-phase filters sit after the raw ones in both banks, so switching crossfades
+        //like any other HRTF change while the onsets glide in the delay lines.
+        const bool minimumPhase = scene.minimumPhase || count > 1;
+        int bankIndices[3];
+        float delayLeft = 0.0f, delayRight = 0.0f;
+        for (int i = 0; i < count; ++i) {
+            const int index = neighbours[i] + bankOffset;
+            bankIndices[i] = index;
+            if (minimumPhase) {
+                bankIndices[i] += minPhaseBankOffset;
+                delayLeft += weights[i] * minPhaseSet.getOnset(index, MinimumPhaseHrirSet::left);
+                delayRight += weights[i] * minPhaseSet.getOnset(index, MinimumPhaseHrirSet::right);
             }
+        }
+
+        if (useFirBackend) {
+            player.firConvolver->setHrtfBlend(bankIndices, weights, count);
+            player.firConvolver->process(mono, voiceScratch.getWritePointer(0), voiceScratch.getWritePointer(1),
+                                         numSamples);
+        } else {
+            player.convolver->setHrtfBlend(bankIndices, weights, count);
+            player.convolver->process(mono, mono, voiceScratch.getWritePointer(0), voiceScratch.getWritePointer(1),
+                                      numSamples);
+        }
 
-            //prepare convolution processors
-            convolutionProcessor->prepareToPlay(sampleRate, samplesExpected);
-            convolutionProcessor->prepareToPlay(sampleRate, samplesExpected);
-            lastAzimuthPos = azimuthSlider.getValue() / 5;
-//        }
+        //Raw HRIRs carry their own onsets, only the min-phase filters need the delay lines.
+        //A line that stood still has stale history and restarts from silence.
+        if (minimumPhase && !player.delayRunning)
+            player.interauralDelay->reset();
+        player.delayRunning = minimumPhase;
+        if (minimumPhase) {
+            player.interauralDelay->setDelays(delayLeft, delayRight);
+            player.interauralDelay->process(voiceScratch.getWritePointer(0), voiceScratch.getWritePointer(1),
+                                            numSamples);
         }
     }
 
     /*=================================================================================*/
 
-    void applyConvolutionPlayer(const AudioSourceChannelInfo *buffer, Player& player) {
+    //Weights snap to multiples of 1 / blendSteps, so a slowly moving player keeps the same
+    //blend for several control intervals and the convolver only crossfades when it changes.
+    //Entries that snap to zero are dropped, the largest takes up the rounding.
+    static int quantiseBlend(int *indices, float *weights, int count) {
+        int kept = 0, largest = 0;
+        float total = 0.0f;
+        for (int i = 0; i < count; ++i) {
+            const float weight = std::round(weights[i] * blendSteps) / blendSteps;
+            if (weight <= 0.0f)
+                continue;
+            indices[kept] = indices[i];
+            weights[kept] = weight;
+            if (weight > weights[largest])
+                largest = kept;
+            total += weight;
+            ++kept;
+        }
+        if (kept > 0)
+            weights[largest] += 1.0f - total;
+        return kept;
+    }
+
+    /*=================================================================================*/
 
-        //Get a preprocessed verstion stored called inputL and inputR
+    //Players and static sounds are encoded into the SH bus with per source gains, the bus is
+    //decoded to binaural once per chunk however many sources are active
+    void renderAmbisonics(const AudioSourceChannelInfo &bufferToFill, int numActive, int order, bool withStatic) {
+        auto &decoder = ambisonicDecoders[order - 1];
+        numActive = jmin(numActive, (int) players.size());
+        const int numStatic = withStatic ? (int) audioList.size() : 0;
+        auto startTicks = Time::getHighResolutionTicks();
+        int64 routeTicks = 0;
+
+        for (int i = 0; i < numStatic; ++i) {
+            auto &sound = audioList[i];
+            sound.encoder->setDirection(order, (float) sound.azimuth, (float) sound.elevation, 1.0f);
+        }
 
-        if (state == Stopped)
-            return;
+        float *mono = voiceScratch.getWritePointer(0);
+        float *outLeft = bufferToFill.buffer->getWritePointer(0, bufferToFill.startSample);
+        float *outRight = bufferToFill.buffer->getWritePointer(1, bufferToFill.startSample);
+
+        for (int done = 0; done < bufferToFill.numSamples;) {
+            int num = jmin(bufferToFill.numSamples - done, decoder.getMaxBlockSize(), voiceScratch.getNumSamples());
+            decoder.clearBus(num);
+
+            //Players move every control interval, each encode ramps to the new direction
+            for (int start = 0; start < num;) {
+                int span = jmin(num - start, scene.controlInterval);
+                auto ticks = Time::getHighResolutionTicks();
+                moveSources(numActive, span);
+                routeTicks += Time::getHighResolutionTicks() - ticks;
+
+                for (int i = 0; i < numActive; ++i) {
+                    auto &encoder = *players[(size_t) i].encoder;
+                    encoder.setDirection(order, sources.azimuth[(size_t) i], sources.elevation[(size_t) i],
+                                         sources.gain[(size_t) i] * sources.trim[(size_t) i]);
+                    readLoop(*sources.clips[(size_t) i], sources.playHeads[(size_t) i], voiceScratch, span, false);
+                    encoder.encode(mono, decoder.getBus(), start, span);
+                }
+                start += span;
+            }
+            for (int i = 0; i < numStatic; ++i) {
+                readLoop(audioList[i], voiceScratch, num, true);
+                audioList[i].encoder->encode(mono, decoder.getBus(), 0, num);
+            }
 
-        convolutionProcessor->processBlock(*buffer->buffer,emptyMidi);
+            decoder.decode(outLeft + done, outRight + done, num);
+            done += num;
+        }
 
-        if (player.hrtfIndex != indexPast) {
-            //Reset convolution processes
+        callbackMonitor.addStageTicks(CallbackMonitor::route, routeTicks);
+        callbackMonitor.addStageTicks(CallbackMonitor::ambisonics,
+                                      Time::getHighResolutionTicks() - startTicks - routeTicks);
 
-            //Write new hrir for convolution at new angle
-            float *irWriteLeft = convolutionProcessor->irBufferLeft.getWritePointer(0);
-            float *irWriteRight = convolutionProcessor->irBufferRight.getWritePointer(0);
-            for (int i = 0; i < 200; i++) {
-                irWriteLeft[i] = player.bufferCurrent.hrtfL.getSample(0, i);
-                irWriteRight[i] = player.bufferCurrent.hrtfR.getSample(0, i);
-            }
+        if (numActive + numStatic > 0) {
+            auto seconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks);
+            renderSecondsPerSource.store(seconds / (numActive + numStatic));
+            renderedSources.store(numActive);
+            renderedOrder.store(order);
+        }
+    }
 
-            //prepare convolution processors
-            convolutionProcessor->prepareToPlay(sampleRate, samplesExpected);
-            indexPast =player.hrtfIndex;
-            std::cout << "convolution reset" << std::endl;
+    /*=================================================================================*/
+
+    //Whatever renders next starts from silence, the other path's state is stale
+    void startRenderMode(int mode) {
+        if (mode == renderBinaural) {
+            for (auto &player : players) {
+                player.convolver->reset();
+                player.firConvolver->reset();
+                player.interauralDelay->reset();
+            }
+        } else {
+            ambisonicDecoders[mode - renderBinaural - 1].reset();
+            for (auto &player : players)
+                player.encoder->reset();
+            for (auto &sound : audioList)
+                if (sound.encoder != nullptr)
+                    sound.encoder->reset();
         }
-        applyGain(buffer, player.gain);
+        activeRenderMode = mode;
+        audioLog.log(AudioLogMessages::renderMode, mode);
     }
 
     /*=================================================================================*/
     void releaseResources() override {
         transportSource->releaseResources();
-        convolutionProcessor->releaseResources();
         filter.releaseResources();
     }
     /*=================================================================================*/
@@ -844,15 +1140,20 @@ public:
         openButton.setBounds(border, 10, getWidth() - 20, 20);
         playButton.setBounds(border - 60, 40, getWidth() - 100, 20);
         stopButton.setBounds(border -60 , 70, getWidth() - 100, 20);
-        loopingToggle.setBounds(border, 100, getWidth() - 20, 20);
-        currentPositionLabel.setBounds(border, 130, getWidth() - 20, 20);
+        exportTimingButton.setBounds(getWidth() - 125, 100, 115, 20);
+        backendBox.setBounds(border, 130 + 110, getWidth() - border, 20);
+        minimumPhaseToggle.setBounds(border, 130 + 140, getWidth() - border, 20);
+        renderModeBox.setBounds(border, 130 + 170, getWidth() - border, 20);
+        currentPositionLabel.setBounds(border, 130, 90, 20);
+        callbackLoadLabel.setBounds(border + 90, 130, getWidth() - border - 100, 20);
 
         frequencySlider.setBounds(border,130 + 20, getWidth() - border, 20);
         durationSlider.setBounds(border, 130 + 50, getWidth() - border, 50);
         homeButton.setBounds(border, 130 + 110, 22, 22);
         awayButton.setBounds(border + 100, 130 + 110, 22, 22);
-        azimuthPosition.setBounds(border, 130 + 170, getWidth() - border, 50);
-        azimuthSlider.setBounds(border, 130 + 200, getWidth() - border, 50);
+        azimuthPosition.setBounds(border, 130 + 200, getWidth() - border, 50);
+        azimuthSlider.setBounds(border, 130 + 230, getWidth() - border, 50);
+        renderCostLabel.setBounds(border, getHeight() - 20, getWidth() - border - 10, 20);
     }
 
     /*=================================================================================*/
@@ -871,13 +1172,20 @@ public:
     void timerCallback() override {
         if (transportSource->isPlaying()) {
 
-            position.operator+=(position.milliseconds(18));
+            position = RelativeTime((double) sceneSamples.load() / sampleRate);
             auto minutes = ((int) position.inMinutes()) % 60;
             auto seconds = ((int) position.inSeconds()) % 60;
             auto millis = ((int) position.inMilliseconds()) % 1000;
             auto positionString = String::formatted("%02d:%02d:%03d", minutes, seconds, millis);
 
             currentPositionLabel.setText(positionString, dontSendNotification);
+
+            auto micros = renderSecondsPerSource.load() * 1.0e6;
+            auto order = renderedOrder.load();
+            String path = order > 0 ? " (HOA " + String(order) + ")" : (renderedWithFir.load() ? " (FIR)" : " (FFT)");
+            renderCostLabel.setText(String(renderedSources.load()) + " players, per source: "
+                                    + String(micros, 1) + " us" + path, dontSendNotification);
+            updateLoadLabel();
         } else {
             currentPositionLabel.setText("Stopped", dontSendNotification);
             position= position.milliseconds(0);
@@ -886,6 +1194,98 @@ public:
 
     /*=================================================================================*/
 
+    //Callback load and the device's own xrun count when it reports one
+    void updateLoadLabel() {
+        auto report = callbackMonitor.getReport();
+        auto &callbackStage = report.stages[CallbackMonitor::callback];
+        String text = "Load " + String(report.load * 100.0, 0) + "% (peak " + String(report.peakLoad * 100.0, 0)
+                      + "%), p50 " + String(callbackStage.p50Micros, 0) + " us, p99 "
+                      + String(callbackStage.p99Micros, 0) + " us, max " + String(callbackStage.maxMicros, 0)
+                      + " us, misses " + String(report.deadlineMisses) + ", late " + String(report.lateCallbacks);
+
+        auto *device = deviceManager.getCurrentAudioDevice();
+        if (device != nullptr && device->getXRunCount() >= 0)
+            text << ", xruns " << device->getXRunCount();
+        if (RealtimeSafety::isEnabled())
+            text << ", unsafe calls " << RealtimeSafety::getNumViolations();
+        callbackLoadLabel.setText(text, dontSendNotification);
+    }
+
+    //Reads the monitor's counters only, the audio thread carries on untouched
+    void exportTiming() {
+        auto file = File::getSpecialLocation(File::userDocumentsDirectory)
+                .getChildFile("UnderPressureTiming " + Time::getCurrentTime().formatted("%Y-%m-%d %H-%M-%S") + ".csv");
+        if (callbackMonitor.writeCsv(file))
+            std::cout << "Callback timing written to " << file.getFullPathName() << "\n";
+        else
+            std::cout << "Could not write " << file.getFullPathName() << "\n";
+    }
+
+    /*=================================================================================*/
+
+    //Message thread only. Feeds on other threads need a CommandQueue of their own.
+    bool postCommand(const SceneCommand &command) {
+        return guiCommands.push(command);
+    }
+
+    /*=================================================================================*/
+
+    //Offline rendering without an audio device, the calling thread stands in for both the
+    //message thread and the audio thread. The pack replaces the cached and shipped ones,
+    //set it before prepareToPlay.
+    void setHrirPack(const File &file) {
+        hrirPackOverride = file;
+    }
+
+    void setSceneParameters(const SceneParameters &parameters) {
+        sceneSnapshot.publish(parameters);
+    }
+
+    //Moves the scene on numSamples exactly as getNextAudioBlock would, without convolving or
+    //mixing anything. Lets a render start part way through a scene.
+    void skipScene(int numSamples) {
+        scene = sceneSnapshot.acquire();
+        guiCommands.drain([this](const SceneCommand &command) { applyCommand(command); });
+
+        if (!scene.playing) {
+            ambience->stop();
+            sceneClock = 0;
+            sceneSamples.store(sceneClock);
+            return;
+        }
+        sceneClock += numSamples;
+        sceneSamples.store(sceneClock);
+        if (scene.renderMode != activeRenderMode)
+            startRenderMode(scene.renderMode);
+
+        const int numActive = jmin(scene.numPlayers, sources.size());
+        moveSources(numActive, numSamples);
+        for (int i = 0; i < numActive; ++i) {
+            sources.mixGain[(size_t) i] = sources.gain[(size_t) i] * sources.trim[(size_t) i];
+            const int length = sources.clips[(size_t) i]->getLength();
+            if (length > 0)
+                sources.playHeads[(size_t) i] = (sources.playHeads[(size_t) i] + numSamples) % length;
+        }
+
+        if (scene.crowdSize > 100) {
+            for (auto &sound : audioList) {
+                sound.mixGain = 1.0f;
+                if (sound.getLength() > 0)
+                    sound.playHead = (sound.playHead + numSamples) % sound.getLength();
+            }
+        }
+
+        if (scene.crowdSize <= 1000) {
+            ambience->stop();
+        } else {
+            if (!ambience->isPlaying())
+                ambience->trigger();
+            ambience->skip(numSamples);
+        }
+    }
+
+    /*=================================================================================*/
+
     void updateLoopState(bool shouldLoop) {
         if (readerSource.get() != nullptr)
             readerSource->setLooping(shouldLoop);
@@ -895,6 +1295,9 @@ public:
     /*=================================================================================*/
 
 private:
+    //The DspBenchmark tool times the private steps on their own
+    friend class EngineBenchmarks;
+
     enum TransportState {
         Stopped,
         Starting,
@@ -905,6 +1308,7 @@ private:
     void changeState(TransportState newState) {
         if (state != newState) {
             state = newState;
+            publishScene();
 
             switch (state) {
                 case Stopped:
@@ -915,6 +1319,7 @@ private:
 
                 case Starting:
                     playButton.setEnabled(false);
+                    callbackMonitor.requestReset();
                     transportSource->start();
                     break;
 
@@ -931,56 +1336,91 @@ private:
 
     /*=================================================================================*/
 
-    void loadFileToTransport() {
-        formatManager.getDefaultFormat();
-        formatManager1.getDefaultFormat();
-        AudioSampleBuffer channel1;
-        auto dir = File::getCurrentWorkingDirectory();
-        int numTries = 0;
+    //Message thread only, called whenever a widget or the transport state changes
+    void publishScene() {
+        SceneParameters parameters;
+        parameters.playing = state == Playing;
+        parameters.numPlayers = (int) durationSlider.getValue();
+        parameters.crowdSize = frequencySlider.getValue();
+        parameters.renderMode = renderModeBox.getSelectedId();
+        parameters.convolutionBackend = backendBox.getSelectedId();
+        parameters.minimumPhase = minimumPhaseToggle.getToggleState();
+        parameters.controlInterval = controlInterval;
+        sceneSnapshot.publish(parameters);
+    }
+
+    /*=================================================================================*/
+
+    //Audio thread, at the start of a block
+    void applyCommand(const SceneCommand &command) {
+        if (!isPositiveAndBelow(command.player, sources.size()))
+            return;
 
-        //find the resources dir
-        while (!dir.getChildFile("Resources").exists() && numTries++ < 15) {
-            dir = dir.getParentDirectory();
+        const auto index = (size_t) command.player;
+        switch (command.type) {
+            case SceneCommand::setPlayerPosition:
+                if (!sources.pinned[index])
+                    audioLog.log(AudioLogMessages::playerPinned, command.player, command.x, command.y);
+                sources.pinned[index] = 1;
+                sources.pinnedX[index] = command.x;
+                sources.pinnedY[index] = command.y;
+                break;
+
+            case SceneCommand::releasePlayer:
+                if (sources.pinned[index])
+                    audioLog.log(AudioLogMessages::playerReleased, command.player);
+                sources.pinned[index] = 0;
+                break;
+
+            case SceneCommand::setPlayerTrim:
+                sources.trim[index] = command.value;
+                break;
+
+            case SceneCommand::setPlayerElevation:
+                sources.elevation[index] = command.value;
+                break;
         }
+    }
+
+    /*=================================================================================*/
 
-        File temp = File(dir.getChildFile("Resources").getChildFile("PlayerLoopMono.wav"));
-        File temp1 = File(dir.getChildFile("Resources").getChildFile("Register.wav"));
-        auto *reader = formatManager.createReaderFor(temp);
+    //Any thread, touches neither the transport nor a component
+    std::unique_ptr<AudioFormatReaderSource> openTransportFile() {
+        auto *reader = assets.createReader("PlayerLoopMono.wav").release();
+        if (reader == nullptr)
+            return nullptr;
+        return std::unique_ptr<AudioFormatReaderSource>(new AudioFormatReaderSource(reader, true));
+    }
 
+    //The thread calling prepareToPlay, which may be a device or render thread, so the button
+    //is only enabled once the message thread gets to it
+    void loadFileToTransport(std::unique_ptr<AudioFormatReaderSource> newSource) {
+        if (newSource == nullptr)
+            return;
 
-        formatManager1.createReaderFor(temp1);
+        transportSource->setSource(newSource.get(), 0, nullptr, newSource->getAudioFormatReader()->sampleRate);
+        readerSource = std::move(newSource);
+        transportSource.get()->setGain(2.0);
+        std::cout << "AudioFile Loaded! \n";
 
-        if (reader != nullptr) {
-            std::unique_ptr<AudioFormatReaderSource> newSource(new AudioFormatReaderSource(reader, true));
-            transportSource->setSource(newSource.get(), 0, nullptr, reader->sampleRate);
-            playButton.setEnabled(true);
-            readerSource.reset(newSource.release());
-            transportSource.get()->setGain(2.0);
-            std::cout << "AudioFile Loaded! \n";
-        }
+        Component::SafePointer<MainContentComponent> safeThis(this);
+        MessageManager::callAsync([safeThis] {
+            if (safeThis != nullptr)
+                safeThis->playButton.setEnabled(true);
+        });
     }
 
     /*=================================================================================*/
 
-    void loadAudioFile(String fileName, float gain) {
-        auto dir = File::getCurrentWorkingDirectory();
-        int numTries = 0;
-        AudioSampleBuffer sampleBuffer;
-        AudioFormatManager formatMan;
-        formatMan.registerBasicFormats();
-        formatMan.getDefaultFormat();
-
-        //find the resources dir
-        while (!dir.getChildFile("Resources").exists() && numTries++ < 15) {
-            dir = dir.getParentDirectory();
-        }
+    File getResourceFile(const String &fileName) {
+        return assets.getFile(fileName);
+    }
 
-        File temp = File(dir.getChildFile("Resources").getChildFile(fileName));
-        while (!dir.getChildFile("Resources").exists() && numTries++ < 15) {
-            dir = dir.getParentDirectory();
-        }
+    /*=================================================================================*/
 
-        std::unique_ptr<AudioFormatReader> source(formatManager.createReaderFor(temp));
+    void loadAudioFile(String fileName, float gain) {
+        AudioSampleBuffer sampleBuffer;
+        auto source = assets.createReader(fileName);
 
         if (source.get() != nullptr) {
             sampleBuffer.setSize(2, (int) source->lengthInSamples);
@@ -998,24 +1438,8 @@ private:
     }
 
     AudioSampleBuffer loadAudioFileToBuffer(String fileName, float gain) {
-        auto dir = File::getCurrentWorkingDirectory();
-        int numTries = 0;
         AudioSampleBuffer sampleBuffer;
-        AudioFormatManager formatMan;
-        formatMan.registerBasicFormats();
-        formatMan.getDefaultFormat();
-
-        //find the resources dir
-        while (!dir.getChildFile("Resources").exists() && numTries++ < 15) {
-            dir = dir.getParentDirectory();
-        }
-
-        File temp = File(dir.getChildFile("Resources").getChildFile(fileName));
-        while (!dir.getChildFile("Resources").exists() && numTries++ < 15) {
-            dir = dir.getParentDirectory();
-        }
-
-        std::unique_ptr<AudioFormatReader> source(formatManager.createReaderFor(temp));
+        auto source = assets.createReader(fileName);
 
         if (source.get() != nullptr) {
             sampleBuffer.setSize(2, (int) source->lengthInSamples);
@@ -1033,24 +1457,8 @@ private:
     }
     /*=================================================================================*/
     AudioPlayer loadAudioFilePlayer(String fileName, float gain) {
-        auto dir = File::getCurrentWorkingDirectory();
-        int numTries = 0;
         AudioSampleBuffer sampleBuffer;
-        AudioFormatManager formatMan;
-        formatMan.registerBasicFormats();
-        formatMan.getDefaultFormat();
-
-        //find the resources dir
-        while (!dir.getChildFile("Resources").exists() && numTries++ < 15) {
-            dir = dir.getParentDirectory();
-        }
-
-        File temp = File(dir.getChildFile("Resources").getChildFile(fileName));
-        while (!dir.getChildFile("Resources").exists() && numTries++ < 15) {
-            dir = dir.getParentDirectory();
-        }
-
-        std::unique_ptr<AudioFormatReader> source(formatManager.createReaderFor(temp));
+        auto source = assets.createReader(fileName);
 
         if (source.get() != nullptr) {
             sampleBuffer.setSize(2, (int) source->lengthInSamples);
@@ -1087,713 +1495,377 @@ private:
 
     /*=================================================================================*/
 
-    void impulseProcessing() {
-        loadConvolutionFiles();
-    }
-
-    /*=================================================================================*/
-
-    void loadConvolutionFiles() {
-        //Front Convolutions
-        AudioSampleBuffer sampleBufferLeft;
-        AudioSampleBuffer sampleBufferRight;
-        AudioSampleBuffer sampleBufferLeftNeg;
-        AudioSampleBuffer sampleBufferRightNeg;
-        AudioSampleBuffer copyL;
-        AudioSampleBuffer copyR;
-        AudioSampleBuffer copyLNegative;
-        AudioSampleBuffer copyRNegative;
-
-        //Behind Convolutions
-        AudioSampleBuffer sampleBufferLeftBehind;
-        AudioSampleBuffer sampleBufferRightBehind;
-        AudioSampleBuffer sampleBufferLeftNegBehind;
-        AudioSampleBuffer sampleBufferRightNegBehind;
-        AudioSampleBuffer copyLBehind;
-        AudioSampleBuffer copyRBehind;
-        AudioSampleBuffer copyLNegativeBehind;
-        AudioSampleBuffer copyRNegativeBehind;
-
-        AudioSampleBuffer posFrontPlusSixL;
-        AudioSampleBuffer posFrontPlusSixR;
-
-        AudioSampleBuffer posBehindPlusSixL;
-        AudioSampleBuffer posBehindPlusSixR;
-
-        AudioSampleBuffer negFrontPlusSixL;
-        AudioSampleBuffer negFrontPlusSixR;
-
-        AudioSampleBuffer negBehindPlusSixL;
-        AudioSampleBuffer negBehindPlusSixR;
-
-        AudioSampleBuffer posFrontMinusSixL;
-        AudioSampleBuffer posFrontMinusSixR;
-
-        AudioSampleBuffer posBehindMinusSixL;
-        AudioSampleBuffer posBehindMinusSixR;
-
-        AudioSampleBuffer negFrontMinusSixL;
-        AudioSampleBuffer negFrontMinusSixR;
-
-        AudioSampleBuffer negBehindMinusSixL;
-        AudioSampleBuffer negBehindMinusSixR;
-
-        //temp vectors
-        std::vector<AudioSampleBuffer> positiveBehindRightVec;
-        std::vector<AudioSampleBuffer> positiveBehindLeftVec;
-
-        std::vector<AudioSampleBuffer> negativeBehindRightVec;
-        std::vector<AudioSampleBuffer> negativeBehindLeftVec;
-
-        AudioFormatManager formatManager1;
-        formatManager1.registerBasicFormats();
-        formatManager1.getDefaultFormat();
-        auto dir = File::getCurrentWorkingDirectory();
-        int numTries = 0;
-        //find the resources dir
-        while (!dir.getChildFile("Resources").exists() && numTries++ < 15) {
-            dir = dir.getParentDirectory();
+    //The subject48 columns go through the same HrirGrid as HrirGridGenerator, so the planes
+    //built here match a shipped grid made with the same azimuth step
+    void buildHrirGrid() {
+        hrirGrid.clear();
+        for (auto &column : HrirGrid::findCipicColumns(assets.getDirectory().getChildFile("subject48"))) {
+            auto *left = getDecodedHrir(column.left.getFileName());
+            auto *right = getDecodedHrir(column.right.getFileName());
+            if (left != nullptr && right != nullptr)
+                hrirGrid.addCipicColumn(*left, *right, column.lateral);
         }
 
-        for (int i = 0; i <= 80; i += 5) {
-            String fileR = "";
-            fileR += i;
-            fileR += "azright.wav";
-            std::cout << fileR;
-            String fileL = "";
-            fileL += i;
-            fileL += "azleft.wav";
-            std::cout << fileL;
-            if (i != 0) {
-                String negR = "neg";
-                negR += i;
-                negR += "azright.wav";
-                String negL = "neg";
-                negL += i;
-                negL += "azleft.wav";
-                File negLeft = File(dir.getChildFile("Resources").getChildFile("subject48").getChildFile(negL));
-                File negRight = File(dir.getChildFile("Resources").getChildFile("subject48").getChildFile(negR));
-                std::unique_ptr<AudioFormatReader> readerNegLeft(formatManager1.createReaderFor(negLeft));
-                std::unique_ptr<AudioFormatReader> readerNegRight(formatManager1.createReaderFor(negRight));
-                //-----------------Negative Azimuth readers-----------------------------------
-                //Load Left HRIR
-                if (readerNegLeft.get() != nullptr) {
-                    sampleBufferLeftNeg.setSize(readerNegLeft->numChannels, (int) readerNegLeft->lengthInSamples);
-                    readerNegLeft->read(&sampleBufferLeftNeg, 0, (int) readerNegLeft->lengthInSamples, 0, true, true);
-                }
-                //Load Right HRIR
-                if (readerNegRight.get() != nullptr) {
-                    sampleBufferRightNeg.setSize(readerNegRight->numChannels, (int) readerNegRight->lengthInSamples);
-                    readerNegRight->read(&sampleBufferRightNeg, 0, (int) readerNegRight->lengthInSamples, 0, true,
-                                         true);
-                }
-            }
-            File fileLeft = File(dir.getChildFile("Resources").getChildFile("subject48").getChildFile(fileL));
-            File fileRight = File(dir.getChildFile("Resources").getChildFile("subject48").getChildFile(fileR));
-
-            std::unique_ptr<AudioFormatReader> readerLeft(formatManager1.createReaderFor(fileLeft));
-            std::unique_ptr<AudioFormatReader> readerRight(formatManager1.createReaderFor(fileRight));
-
-
-            //Load Left HRIR
-            if (readerLeft.get() != nullptr) {
-                sampleBufferLeft.setSize(readerLeft->numChannels, (int) readerRight->lengthInSamples);
-                readerLeft->read(&sampleBufferLeft, 0, (int) readerLeft->lengthInSamples, 0, true, true);
-            }
-            //Load Right HRIR
-            if (readerRight.get() != nullptr) {
-                sampleBufferRight.setSize(readerRight->numChannels, (int) readerRight->lengthInSamples);
-                readerRight->read(&sampleBufferRight, 0, (int) readerRight->lengthInSamples, 0, true, true);
-            }
-
-            //--------------------Reshape the HRIR to the correct shape-------------------------
-            copyR.setSize(1, 200);          //front +
-            copyRNegative.setSize(1, 200);   //front -
-            copyRBehind.setSize(1, 200);         //behind +
-            copyRNegativeBehind.setSize(1, 200); //behind -
-            posFrontPlusSixL.setSize(1, 200);
-            posFrontPlusSixR.setSize(1, 200);
-            posFrontMinusSixL.setSize(1, 200);
-            posFrontMinusSixR.setSize(1, 200);
-            posBehindMinusSixL.setSize(1, 200);
-            posBehindMinusSixR.setSize(1, 200);
-            posBehindPlusSixL.setSize(1, 200);
-            posBehindPlusSixR.setSize(1, 200);
-            negFrontMinusSixL.setSize(1, 200);
-            negFrontMinusSixR.setSize(1, 200);
-            negFrontPlusSixL.setSize(1, 200);
-            negFrontPlusSixR.setSize(1, 200);
-            negBehindMinusSixL.setSize(1, 200);
-            negBehindMinusSixR.setSize(1, 200);
-            negBehindPlusSixL.setSize(1, 200);
-            negBehindPlusSixR.setSize(1, 200);
-
-            //Front level elevation 9
-            //Back level elevation 39
-            const int elevationFront = 8;
-            const int elevationBehind = 40;
-            const int elevationFrontMinusSix = 7;
-            const int elevationFrontPlusSix = 9;
-            const int elevationBehindMinusSix = 41;
-            const int elevationBehindPlusSix = 39;
-            int count = 0;
-            while (count++ < 199) {
-
-                //-----------------------Right Allocation---------------------------------------
-
-                //Reallocate the buffer to the correct shape
-                copyR.setSample(0, count, sampleBufferRight.getSample(count, elevationFront));
-                copyRBehind.setSample(0, count, sampleBufferRight.getSample(count, elevationBehind));
-
-                posFrontMinusSixR.setSample(0, count, sampleBufferRight.getSample(count, elevationFrontMinusSix));
-                posFrontPlusSixR.setSample(0, count, sampleBufferRight.getSample(count, elevationFrontPlusSix));
-                posBehindMinusSixR.setSample(0, count, sampleBufferRight.getSample(count, elevationBehindMinusSix));
-                posBehindPlusSixR.setSample(0, count, sampleBufferRight.getSample(count, elevationBehindPlusSix));
-
-                if (i != 0) {
-                    copyRNegative.setSample(0, count, sampleBufferRightNeg.getSample(count, elevationFront));
-                    copyRNegativeBehind.setSample(0, count, sampleBufferRightNeg.getSample(count, elevationBehind));
-
-                    negFrontMinusSixR.setSample(0, count, sampleBufferRightNeg.getSample(count, elevationFrontMinusSix));
-                    negFrontPlusSixR.setSample(0, count, sampleBufferRightNeg.getSample(count, elevationFrontPlusSix));
-                    negBehindMinusSixR.setSample(0, count, sampleBufferRightNeg.getSample(count, elevationBehindMinusSix));
-                    negBehindPlusSixR.setSample(0, count, sampleBufferRightNeg.getSample(count, elevationBehindPlusSix));
-                }
-            }
-
-            //-----------------------Left Allocation---------------------------------------
-            copyL.setSize(1, (int) 200);         //front +
-            copyLNegative.setSize(1, 200);       //front -
-            copyLBehind.setSize(1, 200);         //behind +
-            copyLNegativeBehind.setSize(1, 200); //behind -
-            count = 0;
-            while (count++ < 199) {
-                //Reallocate the buffer to the correct shape
-                copyL.setSample(0, count, sampleBufferLeft.getSample(count, elevationFront));
-                copyLBehind.setSample(0, count, sampleBufferLeft.getSample(count, elevationBehind));
-                posFrontMinusSixL.setSample(0, count, sampleBufferLeft.getSample(count, elevationFrontMinusSix));
-                posFrontPlusSixL.setSample(0, count, sampleBufferLeft.getSample(count, elevationFrontPlusSix));
-                posBehindMinusSixL.setSample(0, count, sampleBufferLeft.getSample(count, elevationBehindMinusSix));
-                posBehindPlusSixL.setSample(0, count, sampleBufferLeft.getSample(count, elevationBehindPlusSix));
-
-
-                //disregard the 0th index for negative
-                if (i != 0) {
-                    copyLNegative.setSample(0, count, sampleBufferLeftNeg.getSample(count, elevationFront));
-                    copyLNegativeBehind.setSample(0, count, sampleBufferLeftNeg.getSample(count, elevationBehind));
-
-                    negFrontMinusSixL.setSample(0, count, sampleBufferLeftNeg.getSample(count, elevationFrontMinusSix));
-                    negFrontPlusSixL.setSample(0, count, sampleBufferLeftNeg.getSample(count, elevationFrontPlusSix));
-                    negBehindMinusSixL.setSample(0, count, sampleBufferLeftNeg.getSample(count, elevationBehindMinusSix));
-                    negBehindPlusSixL.setSample(0, count, sampleBufferLeftNeg.getSample(count, elevationBehindPlusSix));
-
-                }
-            }
-
-            //Elevations:
-            //[-45 -39 -34 -28 -23 -17 -11 -6  0   6         || 0-9
-            //  11  17  23  28  34  39  45 51  56  62        || 10-19
-            //  68  73  79  84  90  96 101 107 113 118       || 20-29
-            //  124 129 135 141 146 152 158 163 169 174      || 30-39
-            //  180 186 191 197 203 208 214 219 225 231]     || 40-49
-            //Push audio buffer to temp vector
-
-            if (i <= 45) {
-                // 0 - 80 (16 azimuths)
-                rightVec.push_back(copyR);
-                leftVec.push_back(copyL);
-                HRTFData tempFront(copyL, copyR, i, 0, 1);
-                zeroPlane.push_back(tempFront);
-
-                // 180 - 260 (16 azimuths)
-
-                positiveBehindRightVec.push_back(copyRBehind);
-                positiveBehindLeftVec.push_back(copyLBehind);
-                tempFront.update(copyLBehind, copyRBehind, 180 - i, 0, 1);
-                zeroPlane.push_back(tempFront);
-
-                //Q1
-                HRTFData tempMinus(posFrontMinusSixL, posFrontMinusSixR, i, -6, 1);
-                HRTFData tempPlus(posFrontPlusSixL, posFrontPlusSixR, i, 6, 1);
-
-                minusSix.push_back(tempMinus);
-                plusSix.push_back(tempPlus);
-
-
-                //Q2
-                HRTFData tempMinusB(posBehindMinusSixL, posBehindMinusSixR, 180 - (i), -6, 1);
-                HRTFData tempPlusB(posBehindPlusSixL, posBehindPlusSixR, 180 - (i), 6, 1);
-
-                minusSix.push_back(tempMinusB);
-                plusSix.push_back(tempPlusB);
-
-                if (i != 0) {
-                    //Q3
-                    HRTFData tempMinusNegBehind(negBehindMinusSixL, negBehindMinusSixR, 180 + (i), -6, 1);
-                    HRTFData tempPlusNegBehind(negBehindPlusSixL, negBehindPlusSixR, 180 + (i), 6, 1);
-                    minusSix.push_back(tempMinusNegBehind);
-                    plusSix.push_back(tempPlusNegBehind);
-
-                    //Q4
-                    HRTFData tempMinusNeg(negFrontMinusSixL, negFrontMinusSixR, 360 - (i), -6, 1);
-                    HRTFData tempPlusNeg(negFrontPlusSixL, negFrontPlusSixR, 360 - (i), 6, 1);
-
-                    minusSix.push_back(tempMinusNeg);
-                    plusSix.push_back(tempPlusNeg);
-                }
-            }
-
-
-            if (i == 55 || i == 65 || i == 80) {
-
-                // 0-80 (16 azimuths)
-                rightVec.push_back(copyR);
-                leftVec.push_back(copyL);
-                HRTFData tempFront;
-                tempFront.update(copyL, copyR, i, 0, 1);
-                zeroPlane.push_back(tempFront);
-
-                // 180-80 (16 azimuths)
-                positiveBehindRightVec.push_back(copyRBehind);
-                positiveBehindLeftVec.push_back(copyLBehind);
-                tempFront.update(copyLBehind, copyRBehind, 180 - i, 0, 1);
-                zeroPlane.push_back(tempFront);
-
-                //Q1
-                HRTFData tempMinus(posFrontMinusSixL, posFrontMinusSixR, i, -6, 1);
-                HRTFData tempPlus(posFrontPlusSixL, posFrontPlusSixR, i, 6, 1);
-
-                minusSix.push_back(tempMinus);
-                plusSix.push_back(tempPlus);
-
-
-                //Q2
-                HRTFData tempMinusB(posBehindMinusSixL, posBehindMinusSixR, 180 - (i), -6, 1);
-                HRTFData tempPlusB(posBehindPlusSixL, posBehindPlusSixR, 180 - (i), 6, 1);
-
-                minusSix.push_back(tempMinusB);
-                plusSix.push_back(tempPlusB);
-
-                //Q3
-                HRTFData tempMinusNegBehind(negBehindMinusSixL, negBehindMinusSixR, 180 + (i), -6, 1);
-                HRTFData tempPlusNegBehind(negBehindPlusSixL, negBehindPlusSixR, 180 + (i), 6, 1);
-                minusSix.push_back(tempMinusNegBehind);
-                plusSix.push_back(tempPlusNegBehind);
-
-                //Q4
-                HRTFData tempMinusNeg(negFrontMinusSixL, negFrontMinusSixR, 360 - (i), -6, 1);
-                HRTFData tempPlusNeg(negFrontPlusSixL, negFrontPlusSixR, 360 - (i), 6, 1);
-
-                minusSix.push_back(tempMinusNeg);
-                plusSix.push_back(tempPlusNeg);
-            }
-
-            //disregard the 0th index for negative
-            if (i != 0) {
-                if (i <= 45) {
-                    // 355 - 280 (backwards) (15 azimuths)
-                    leftVecNeg.push_back(copyLNegative);
-                    rightVecNeg.push_back(copyRNegative);
-
-                    HRTFData tempFront;
-                    tempFront.update(copyLNegative, copyRNegative, 360 - i, 0, 1);
-                    zeroPlane.push_back(tempFront);
-
-                    // 185 - 260 (backwards) (15 azimuths)
-                    negativeBehindLeftVec.push_back(copyLNegativeBehind);
-                    negativeBehindRightVec.push_back(copyRNegativeBehind);
-                    tempFront.update(copyLNegativeBehind, copyRNegativeBehind, 180 + i, 0, 1);
-                    zeroPlane.push_back(tempFront);
-                }
-                if (i == 55 || i == 65 || i == 80) {
-
-                    // 355 - 280 (backwards) (15 azimuths)
-                    leftVecNeg.push_back(copyLNegative);
-                    rightVecNeg.push_back(copyRNegative);
-                    HRTFData tempFront;
-                    tempFront.update(copyLNegative, copyRNegative, 360 - i, 0, 1);
-                    zeroPlane.push_back(tempFront);
-
-                    // 185 - 260 (backwards) (15 azimuths)
-                    negativeBehindLeftVec.push_back(copyLNegativeBehind);
-                    negativeBehindRightVec.push_back(copyRNegativeBehind);
-                    tempFront.update(copyLNegativeBehind, copyRNegativeBehind, 180 + i, 0, 1);
-                    zeroPlane.push_back(tempFront);
-                }
-            }
-        }
-
-        //Reorder all Audio buffers to one vector
-        for (int i = 0; i < leftVec.size(); i++) {
-            leftHRIR.push_back(leftVec.at(i));
-            rightHRIR.push_back(rightVec.at(i));
+        if (!hrirGrid.buildSphere(hrtfSphere)) {
+            std::cout << "Could not triangulate the subject48 HRIRs\n";
+            return;
         }
+        std::cout << "HRTF sphere: " << hrtfSphere.size() << " directions, " << hrtfSphere.getNumTriangles()
+                  << " triangles\n";
 
+        //A pool of its own, addPlanes waits for its jobs and this already runs on the startup pool
+        ThreadPool pool(jmax(1, SystemStats::getNumCpus()));
+        hrirGrid.addPlanes(hrtfSphere, planeAzimuthStep, pool);
+        restorePlanes(hrirGrid.getSources(), HrirGrid::impulseLength);
+    }
 
-        for (int i = (int) positiveBehindLeftVec.size() - 1; i >= 0; i--) {
-            leftHRIR.push_back(positiveBehindLeftVec.at(i));
-            rightHRIR.push_back(positiveBehindRightVec.at(i));
-        }
+    /*=================================================================================*/
 
-        for (int i = 0; i < negativeBehindLeftVec.size(); i++) {
-            leftHRIR.push_back(negativeBehindLeftVec.at(i));
-            rightHRIR.push_back(negativeBehindRightVec.at(i));
+    static int getPartitionSizeFor(int samplesPerBlock) { return jlimit(32, 1024, nextPowerOfTwo(samplesPerBlock)); }
+
+    //Everything the processed HRIR set depends on, the measured WAVs and the decomposition
+    //settings. Paths, sizes and dates only, nothing is read.
+    uint64 getHrirSourceKey(int partitionSize) const {
+        RenderCache::Key key;
+        key.add((int) HrirPack::formatVersion).add(partitionSize).add(MinimumPhaseHrirSet::defaultLength)
+            .add((double) HrirDecomposition::onsetThreshold);
+
+        auto sources = assets.getDirectory().getChildFile("subject48").findChildFiles(File::findFiles, false, "*.wav");
+        sources.sort();
+        for (auto &file : sources)
+            key.add(file);
+        return key.getValue();
+    }
+
+    //Maps the processed HRIR set from its pack if one matching the sources exists, else the
+    //grid shipped in Resources, made offline by HrirGridGenerator. That grid is optional and
+    //not checked in. Only when neither is there are the WAVs decoded, interpolated and
+    //decomposed, then packed by writeHrirPack.
+    bool openHrirPack(int partitionSize) {
+        if (hrirPackOverride != File()) {
+            if (!hrirPack.open(hrirPackOverride))
+                std::cout << "Could not open HRIR pack " << hrirPackOverride.getFullPathName() << "\n";
+            return hrirPack.isOpen();
         }
 
-        for (int i = (int) leftVecNeg.size() - 1; i >= 0; i--) {
-            leftHRIR.push_back(leftVecNeg.at(i));
-            rightHRIR.push_back(rightVecNeg.at(i));
+        const auto key = getHrirSourceKey(partitionSize);
+        auto file = HrirPack::getDefaultFileFor(key, partitionSize);
+        if (!hrirPack.open(file, key, partitionSize)) {
+            file = assets.getFile(shippedHrirGrid);
+            if (!hrirPack.open(file))
+                return false;
         }
 
-        //Sort All the Loaded HRTFS
-        minusSix = HRTFData::SortByAzimuth(minusSix);
-        plusSix = HRTFData::SortByAzimuth(plusSix);
-        zeroPlane = HRTFData::SortByAzimuth(zeroPlane);
-
-        addInterpolatedPoints();
-        convertBaselineHrtf();
-        leftZero = zeroPlane.at(0).hrtfL;
-        rightZero = zeroPlane.at(0).hrtfR;
+        std::cout << "HRIR pack: " << hrirPack.size() << " entries, partition " << hrirPack.getPartitionSize()
+                  << " from " << file.getFullPathName() << "\n";
+        return true;
     }
 
-    /*=================================================================================*/
+    //Packs the grid that buildHrirGrid produced and maps the result
+    void writeHrirPack(int partitionSize) {
+        const auto key = getHrirSourceKey(partitionSize);
+        const auto file = HrirPack::getDefaultFileFor(key, partitionSize);
 
-    void addInterpolatedPoints() {
-        //add 50, 60, 70, 75, 85 90, 95
-        HRTFData newPoint;
-        HRTFData newPoint1;
-        HRTFData newPoint2;
-
-        int azimuthNew;
-
-        //pt1, pt2, pt3, az, elev
-        HRTFData pt1;
-        HRTFData pt2;
-        HRTFData pt3;
-
-        //90
-        azimuthNew = 90;
-        pt1 = HRTFData::findByAzimuth(minusSix, azimuthNew - 10);
-        pt2 = HRTFData::findByAzimuth(plusSix, azimuthNew - 10);
-        pt3 = HRTFData::findByAzimuth(zeroPlane, azimuthNew + 10);
-
-        newPoint = interpolatePoint(pt1,pt2,pt3, azimuthNew, 0);
-        newPoint1 = interpolatePoint(pt1,pt2,pt3, azimuthNew, +6);
-        newPoint2 = interpolatePoint(pt1,pt2,pt3, azimuthNew, -6);
-        newPoint.printAll();
-
-        zeroPlane.push_back(newPoint);
-        minusSix.push_back(newPoint1);
-        plusSix.push_back(newPoint2);
-
-        //270
-        azimuthNew = 270;
-        pt1 = HRTFData::findByAzimuth(minusSix, azimuthNew - 10);
-        pt2 = HRTFData::findByAzimuth(plusSix, azimuthNew - 10);
-        pt3 = HRTFData::findByAzimuth(zeroPlane,azimuthNew + 10);
-
-        newPoint = interpolatePoint(pt1,pt2,pt3, azimuthNew, 0);
-        newPoint1 = interpolatePoint(pt1,pt2,pt3, azimuthNew, +6);
-        newPoint2 = interpolatePoint(pt1,pt2,pt3, azimuthNew, -6);
-        zeroPlane.push_back(newPoint);
-        minusSix.push_back(newPoint1);
-        plusSix.push_back(newPoint2);
-        newPoint.printAll();
-
-        minusSix = HRTFData::SortByAzimuth(minusSix);
-        plusSix = HRTFData::SortByAzimuth(plusSix);
-        zeroPlane = HRTFData::SortByAzimuth(zeroPlane);
-
-        int index = 0;
-        std::vector<int>::iterator it;
-        it = azimuthAngles.begin();
-
-        while(true){
-            //Create a new point and add to azimuth angles
-            if (azimuthAngles[index] != index *5){
-                azimuthNew = index * 5;
-                pt1 = HRTFData::findByAzimuth(minusSix, azimuthAngles[index - 1]);
-                pt2 = HRTFData::findByAzimuth(plusSix, azimuthAngles[index - 1]);
-                pt3 = HRTFData::findByAzimuth(zeroPlane,azimuthAngles[index]);
-                newPoint = interpolatePoint(pt1,pt2,pt3, azimuthNew, 0);
-                newPoint1 = interpolatePoint(pt1,pt2,pt3, azimuthNew, +6);
-                newPoint2 = interpolatePoint(pt1,pt2,pt3, azimuthNew, -6);
-
-                zeroPlane.push_back(newPoint);
-                minusSix.push_back(newPoint1);
-                plusSix.push_back(newPoint2);
-
-                azimuthAngles.insert(it, azimuthNew);
-                newPoint.printAll();
-                index = 0;
-                it = azimuthAngles.begin();
-                minusSix = HRTFData::SortByAzimuth(minusSix);
-                plusSix = HRTFData::SortByAzimuth(plusSix);
-                zeroPlane = HRTFData::SortByAzimuth(zeroPlane);
-                if (azimuthNew == 310){break;}
-                continue;
-            }
-            index++;
-            it++;
-        }
-        std::cout << "Finished interpolation \n";
+        if (HrirPack::write(file, key, partitionSize, HrirGrid::impulseLength, MinimumPhaseHrirSet::defaultLength,
+                            hrirGrid.getSources())
+            && hrirPack.open(file, key, partitionSize))
+            std::cout << "HRIR pack written to " << file.getFullPathName() << "\n";
     }
 
     /*=================================================================================*/
 
-    void convertBaselineHrtf() {
-        std::map<int, HRTFData> tempPair;
-
-        for (int i = 0; i < azimuthAngles.size(); i++) {
-            HRTFData temp(zeroPlane.at(i).hrtfL, zeroPlane.at(i).hrtfR, azimuthAngles.at(i), 0, 1);
-            tempPair.insert(std::pair<int, HRTFData>(azimuthAngles.at(i), temp));
+    //Adds an empty slot for every subject48 WAV and returns their names, so the decodes can
+    //then fill the slots from any thread without touching the map itself
+    StringArray prepareHrirDecodes() {
+        decodedHrirs.clear();
+        StringArray names;
+        for (auto &file : assets.getDirectory().getChildFile("subject48").findChildFiles(File::findFiles, false, "*.wav")) {
+            names.add(file.getFileName());
+            decodedHrirs[file.getFileName()];
         }
-        hrtfMap.insert(std::pair<int, AzimuthInnerMap>(0, tempPair));
-
-        std::cout << "Count Map Size:" << hrtfMap.size();
-        HRTFData::printMap(hrtfMap);
+        return names;
     }
 
-    /*=================================================================================*/
-
-
-    void applyGainToHRTF(HRTFData &pt1, HRTFData &pt2, HRTFData &pt3, Mat gain, int az, int elv, HRTFData &hrtfData) {
-
-        AudioSampleBuffer bufferL;
-        AudioSampleBuffer bufferR;
-        bufferL.setSize(1, 200);
-        bufferR.setSize(1, 200);
-        float l;
-        float r;
+    void decodeHrir(const String &name) {
+        auto slot = decodedHrirs.find(name);
+        if (slot == decodedHrirs.end())
+            slot = decodedHrirs.emplace(name, AudioSampleBuffer()).first;
 
-        for (int i = 0; i < 200; i++) {
-            l = (gain(0, 0) * pt1.hrtfL.getSample(0, i)) + (gain(0, 1) * pt2.hrtfL.getSample(0, i)) +
-                (gain(0, 2) * pt3.hrtfL.getSample(0, i));
-            bufferL.setSample(0, i, l);
-            r = (gain(0, 0) * pt1.hrtfR.getSample(0, i)) + (gain(0, 1) * pt2.hrtfR.getSample(0, i)) +
-                (gain(0, 2) * pt3.hrtfR.getSample(0, i));
-            bufferR.setSample(0, i, r);
+        //As HrirGrid::addCipicColumn reads them, one tap per channel and a polar angle per sample
+        auto &buffer = slot->second;
+        auto reader = assets.createReader("subject48/" + name);
+        if (reader != nullptr) {
+            buffer.setSize((int) reader->numChannels, (int) reader->lengthInSamples);
+            reader->read(&buffer, 0, (int) reader->lengthInSamples, 0, true, true);
         }
-        HRTFData tempH(bufferL, bufferR, az, elv, 1);
-        tempH.calculateRms();
-        tempH.printRms();
-        hrtfData = tempH;
     }
 
-    /*=================================================================================*/
-
-    HRTFData interpolatePoint(HRTFData pt1, HRTFData pt2, HRTFData pt3, int az, int elv) {
-
-        dsp::Matrix<double> i(1, 3);
-        dsp::Matrix<double> j(1, 3);
-        dsp::Matrix<double> k(1, 3);
-        dsp::Matrix<double> m(1, 3);
-
-        i = getVector(pt1.distance, pt1.azimuth, pt1.elevation + 90);
-        j = getVector(pt2.distance, pt2.azimuth, pt2.elevation + 90);
-        k = getVector(pt3.distance, pt3.azimuth, pt3.elevation + 90);
-        m = getVector(1, az, elv + 90);
-
-        Mat gain(0, 3);
-        gain = matrixGains(i, j, k, m);
-        HRTFData tempH;
-        applyGainToHRTF(pt1, pt2, pt3, gain, az, elv, tempH);
-
-        return tempH;
+    //The decoded file, decoding it here if nothing did so ahead of time. Null if it is missing.
+    const AudioSampleBuffer *getDecodedHrir(const String &name) {
+        auto slot = decodedHrirs.find(name);
+        if (slot == decodedHrirs.end()) {
+            decodeHrir(name);
+            slot = decodedHrirs.find(name);
+        }
+        return slot->second.getNumSamples() > 0 ? &slot->second : nullptr;
+    }
+
+    //Rebuilds the planes and sphere from pack sources sorted by group, group 0 is zeroPlane,
+    //1 plusSix, 2 minusSix and 3 the full sphere in bank order
+    void restorePlanes(const std::vector<HrirPack::Source> &sources, int length) {
+        std::vector<HRTFData> *planes[] = {&zeroPlane, &plusSix, &minusSix, &sphere};
+        for (auto *plane : planes)
+            plane->clear();
+        sphereDirections.clear();
+
+        for (auto &source : sources) {
+            AudioSampleBuffer left(1, length), right(1, length);
+            left.copyFrom(0, 0, source.left, length);
+            right.copyFrom(0, 0, source.right, length);
+            const int group = jlimit(0, 3, source.group);
+            planes[group]->push_back(
+                HRTFData(left, right, roundToInt(source.azimuth), roundToInt(source.elevation), 1));
+            if (group == HrirGrid::sphereGroup)
+                sphereDirections.push_back({source.azimuth, source.elevation});
+        }
     }
-    /*=================================================================================*/
-
-    //Verified and correct
-    dsp::Matrix<double> getVector(double radius, double azimuth, double elevation) {
-        double x = cos(degreesToRadians(azimuth)) * sin(degreesToRadians(elevation));
-        double y = radius * sin(degreesToRadians(azimuth)) * sin(degreesToRadians(elevation));
-        double z = radius * cos(degreesToRadians(elevation));
-
-        std::cout << " x:" << x << " y:" << y << " z:" << z << "\n";
-        dsp::Matrix<double> cart(1, 3);
-        cart(0, 0) = x;
-        cart(0, 1) = y;
-        cart(0, 2) = z;
 
-        return cart;
+    void restorePlanesFromPack() {
+        std::vector<HrirPack::Source> sources;
+        for (int i = 0; i < hrirPack.size(); ++i)
+            sources.push_back({hrirPack.getAzimuth(i), hrirPack.getElevation(i), hrirPack.getGroup(i),
+                               hrirPack.getTaps(i, 0), hrirPack.getTaps(i, 1)});
+        restorePlanes(sources, hrirPack.getImpulseLength());
+        buildHrtfSphere();
     }
 
     /*=================================================================================*/
 
-    //This is working and verified
-    Mat matrixGains(dsp::Matrix<double> a, dsp::Matrix<double> b, dsp::Matrix<double> c, dsp::Matrix<double> p) {
-        dsp::Matrix<double> m(3, 3);
-        dsp::Matrix<double> d(1, 3);
-        dsp::Matrix<double> minv(3, 3);
-
-        //Vectors
-        dsp::Matrix<double> i(1, 3);
-        dsp::Matrix<double> j(1, 3);
-        dsp::Matrix<double> k(1, 3);
-
-        dsp::Matrix<double> g(1, 3);
-
-        for (int j = 0; j < 3; j++) {
-            std::cout << "P Matrix:" << p(0, j) << "\n";
-
+    //FFT the whole HRIR bank once and keep the aligned taps for the FIR backend, zeroPlane
+    //first so bank index == azimuth index in both and the full sphere last. The minimum phase
+    //filters follow the raw ones in the same order, minPhaseBankOffset apart. The same HRIRs
+    //are added to the SH decoders of every Ambisonics order, which the "Ambisonic decoder order"
+    //startup tasks fit once the banks are built.
+    void buildHrtfBanks(int samplesPerBlock) {
+        const int partitionSize = getPartitionSizeFor(samplesPerBlock);
+        if (hrirPack.isOpen() && hrirPack.getPartitionSize() == partitionSize) {
+            buildHrtfBanksFromPack(samplesPerBlock);
+            return;
         }
 
-        for (int j = 0; j < 3; j++) {
-            m(0, j) = a(0, j);
-            m(1, j) = b(0, j);
-            m(2, j) = c(0, j);
-        }
-        for (int i = 0; i < 3; i++) {
-            std::cout << " | ";
-            for (int j = 0; j < 3; j++) {
-                std::cout << "  " << m(i, j);
+        const int numImpulses = (int) (zeroPlane.size() + plusSix.size() + minusSix.size() + sphere.size());
+        hrtfBank.setPartitionSize(partitionSize, 200);
+        hrirTapBank.setImpulseLength(200, numImpulses * 2);
+        minPhaseSet.clear(MinimumPhaseHrirSet::defaultLength);
+        for (auto &decoder : ambisonicDecoders)
+            decoder.clearDirections(200);
+
+        for (auto *plane : {&zeroPlane, &plusSix, &minusSix, &sphere}) {
+            if (plane == &plusSix)
+                plusSixBankOffset = hrtfBank.size();
+            if (plane == &minusSix)
+                minusSixBankOffset = hrtfBank.size();
+            if (plane == &sphere)
+                sphereBankOffset = hrtfBank.size();
+
+            for (size_t i = 0; i < plane->size(); ++i) {
+                auto &hrtf = (*plane)[i];
+                hrtfBank.addImpulse(hrtf.hrtfL.getReadPointer(0), hrtf.hrtfR.getReadPointer(0), 200);
+                hrirTapBank.addImpulse(hrtf.hrtfL.getReadPointer(0), hrtf.hrtfR.getReadPointer(0), 200);
+                minPhaseSet.add(hrtf.hrtfL.getReadPointer(0), hrtf.hrtfR.getReadPointer(0), 200);
+
+                auto azimuth = plane == &sphere ? sphereDirections[i].x : (float) hrtf.azimuth;
+                auto elevation = plane == &sphere ? sphereDirections[i].y : (float) hrtf.elevation;
+                for (auto &decoder : ambisonicDecoders)
+                    decoder.addDirection(azimuth, elevation, hrtf.hrtfL.getReadPointer(0), hrtf.hrtfR.getReadPointer(0));
             }
-            std::cout << " | \n";
-        }
-        // computes the inverse of a matrix m
-        double det = m(0, 0) * (m(1, 1) * m(2, 2) - m(2, 1) * m(1, 2)) -
-                     m(0, 1) * (m(1, 0) * m(2, 2) - m(1, 2) * m(2, 0)) +
-                     m(0, 2) * (m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0));
-
-        if (det == 0) {
-            Mat t(1, 3);
-            t(0, 0) = 0;
-            t(0, 1) = 0;
-            t(0, 2) = 0;
-            return t;
         }
-        double invdet = 1 / det;
 
+        minPhaseBankOffset = hrtfBank.size();
+        const int filterLength = minPhaseSet.getFilterLength();
+        for (int i = 0; i < minPhaseSet.size(); ++i) {
+            auto *filterL = minPhaseSet.getFilter(i, MinimumPhaseHrirSet::left);
+            auto *filterR = minPhaseSet.getFilter(i, MinimumPhaseHrirSet::right);
+            hrtfBank.addImpulse(filterL, filterR, filterLength);
+            hrirTapBank.addImpulse(filterL, filterR, filterLength);
+        }
 
-        minv(0, 0) = (m(1, 1) * m(2, 2) - m(2, 1) * m(1, 2)) * invdet;
-        minv(0, 1) = (m(0, 2) * m(2, 1) - m(0, 1) * m(2, 2)) * invdet;
-        minv(0, 2) = (m(0, 1) * m(1, 2) - m(0, 2) * m(1, 1)) * invdet;
-        minv(1, 0) = (m(1, 2) * m(2, 0) - m(1, 0) * m(2, 2)) * invdet;
-        minv(1, 1) = (m(0, 0) * m(2, 2) - m(0, 2) * m(2, 0)) * invdet;
-        minv(1, 2) = (m(1, 0) * m(0, 2) - m(0, 0) * m(1, 2)) * invdet;
-        minv(2, 0) = (m(1, 0) * m(2, 1) - m(2, 0) * m(1, 1)) * invdet;
-        minv(2, 1) = (m(2, 0) * m(0, 1) - m(0, 0) * m(2, 1)) * invdet;
-        minv(2, 2) = (m(0, 0) * m(1, 1) - m(1, 0) * m(0, 1)) * invdet;
+        std::cout << "HRTF spectrum bank: " << hrtfBank.size() << " impulses, partition " << partitionSize << "\n";
+    }
+
+    //Same banks in the same order, copied from the mapped pack without any FFT or
+    //decomposition
+    void buildHrtfBanksFromPack(int samplesPerBlock) {
+        const int partitionSize = hrirPack.getPartitionSize();
+        const int impulseLength = hrirPack.getImpulseLength();
+        const int filterLength = hrirPack.getFilterLength();
+        hrtfBank.setPartitionSize(partitionSize, impulseLength);
+        hrirTapBank.setImpulseLength(impulseLength, hrirPack.size() * 2);
+        minPhaseSet.clear(filterLength);
+        for (auto &decoder : ambisonicDecoders)
+            decoder.clearDirections(impulseLength);
+
+        plusSixBankOffset = minusSixBankOffset = sphereBankOffset = hrirPack.size();
+        for (int i = hrirPack.size(); --i >= 0;) {
+            if (hrirPack.getGroup(i) >= 1)
+                plusSixBankOffset = i;
+            if (hrirPack.getGroup(i) >= 2)
+                minusSixBankOffset = i;
+            if (hrirPack.getGroup(i) >= 3)
+                sphereBankOffset = i;
+        }
 
-        g = p * minv;
+        for (int i = 0; i < hrirPack.size(); ++i) {
+            auto *tapsL = hrirPack.getTaps(i, 0);
+            auto *tapsR = hrirPack.getTaps(i, 1);
+            hrtfBank.addSpectra(hrirPack.getSpectra(i), hrirPack.getNumSegments(i));
+            hrirTapBank.addImpulse(tapsL, tapsR, impulseLength);
+            minPhaseSet.addDecomposed(hrirPack.getMinPhaseFilter(i, 0), hrirPack.getMinPhaseFilter(i, 1),
+                                      hrirPack.getOnset(i, 0), hrirPack.getOnset(i, 1));
+            for (auto &decoder : ambisonicDecoders)
+                decoder.addDirection(hrirPack.getAzimuth(i), hrirPack.getElevation(i), tapsL, tapsR);
+        }
 
-        std::cout << "---------Interpolation Gains-------" << " | \n";
-        for (int j = 0; j < 3; j++) {
-            std::cout << " | " << g(0, j) << " | \n";
+        minPhaseBankOffset = hrtfBank.size();
+        for (int i = 0; i < hrirPack.size(); ++i) {
+            hrtfBank.addSpectra(hrirPack.getMinPhaseSpectra(i), hrirPack.getMinPhaseSegments(i));
+            hrirTapBank.addImpulse(hrirPack.getMinPhaseFilter(i, 0), hrirPack.getMinPhaseFilter(i, 1), filterLength);
         }
 
-        return g;
+        std::cout << "HRTF spectrum bank: " << hrtfBank.size() << " impulses from pack, partition " << partitionSize << "\n";
     }
 
     /*=================================================================================*/
-    void loadPlayer(String filename, Player player){
 
-        AudioPlayer temp = loadAudioFilePlayer(filename, .80f);
-        player.audioPlayer.buffer = temp.buffer;
-        player.audioPlayer.gain = temp.gain;
+    //Indexes the three planes by their bank indices, zeroPlane first so it wins any tie
+    void buildPlaneIndex() {
+        planeIndex.clear();
+        const std::pair<std::vector<HRTFData> *, int> planes[] = {
+            {&zeroPlane, 0}, {&plusSix, plusSixBankOffset}, {&minusSix, minusSixBankOffset}};
+        for (auto &plane : planes)
+            for (size_t i = 0; i < plane.first->size(); ++i)
+                planeIndex.add((float) (*plane.first)[i].azimuth, (float) (*plane.first)[i].elevation,
+                               plane.second + (int) i);
+        planeIndex.build();
+    }
 
+    /*=================================================================================*/
 
-        player.currentPos.x = 0.0f;
-        player.currentPos.y = 8.0f;
-        Position posTemp;
+    void buildHrtfSphere() {
+        hrtfSphere.clear();
+        for (auto &direction : sphereDirections)
+            hrtfSphere.addDirection(direction.x, direction.y);
 
-        player.buildRoute(player.currentPos);
-        posTemp.x += 0.0;
-        posTemp.y += 8.0f;
-        player.addToRoute(posTemp);
+        if (hrtfSphere.build())
+            std::cout << "HRTF sphere: " << hrtfSphere.size() << " directions, " << hrtfSphere.getNumTriangles()
+                      << " triangles\n";
+    }
 
-        while(posTemp.y < 10.0f) {
-            posTemp.x += 0.25;
-            posTemp.y += 0.5f;
-            player.addToRoute(posTemp);
-            //std::cout << "Azimuth: " << vectorToSphere(posTemp).azimuth << "\n";
-            //std::cout << "Radius: " << vectorToSphere(posTemp).radius << "\n";
-        }
-        while(posTemp.y < 25.0f) {
-            posTemp.x += 0.5f;
-            posTemp.y += 1.0f;
-            player.addToRoute(posTemp);
-            //std::cout << "Azimuth: " << vectorToSphere(posTemp).azimuth << "\n";
-            //std::cout << "Radius: " << vectorToSphere(posTemp).radius << "\n";
-        }
-        while(posTemp.y >= 8.0f) {
-            posTemp.x -= 1.5f;
-            posTemp.y -= 1.0f;
-            player.addToRoute(posTemp);
-            //std::cout << "Azimuth: " << vectorToSphere(posTemp).azimuth << "\n";
-            //std::cout << "Radius: " << vectorToSphere(posTemp).radius << "\n";
+    /*=================================================================================*/
+    void loadPlayers(String filename, int count){
+        players.clear();
+        sources.clear();
+
+        //Every player reads the same clip, mapped pages or one decoded buffer for all of them
+        auto clip = std::make_shared<AudioPlayer>();
+        clip->gain = .80f;
+        clip->mapped = assets.getMapped(filename);
+        if (clip->mapped == nullptr)
+            *clip = loadAudioFilePlayer(filename, .80f);
+
+        loadPlayerRoutes("Routes/PlayerRoute.json");
+        for (int i = 0; i < count; i++)
+            loadPlayer(clip, i);
+    }
+
+    //Both sides of the court share one set of waypoints, a lap takes secondsPerRouteNode
+    //per waypoint. Without the file the players stand still at the first default waypoint.
+    void loadPlayerRoutes(const String &name){
+        auto route = std::make_shared<RouteSpline>();
+        auto result = route->loadJson(assets.getFile(name));
+        if (result.failed()) {
+            std::cout << "Player route: " << result.getErrorMessage() << "\n";
+            route->clear();
+            route->addWaypoint(0.0f, 8.0f);
         }
 
-        while(posTemp.x >= -20.0f) {
-            posTemp.x -= .5f;
-            player.addToRoute(posTemp);
-            //std::cout << "Azimuth: " << vectorToSphere(posTemp).azimuth << "\n";
-            //std::cout << "Radius: " << vectorToSphere(posTemp).radius << "\n";
-        }
+        auto mirrored = std::make_shared<RouteSpline>(*route);
+        mirrored->mirror();
+        route->build(route->getNumWaypoints() * secondsPerRouteNode);
+        mirrored->build(mirrored->getNumWaypoints() * secondsPerRouteNode);
+        playerRoute = route;
+        mirroredRoute = mirrored;
+    }
 
-        while(posTemp.x <= 0) {
-            posTemp.x += .5f;
-            player.addToRoute(posTemp);
-            //std::cout << "Azimuth: " << vectorToSphere(posTemp).azimuth << "\n";
-            //std::cout << "Radius: " << vectorToSphere(posTemp).radius << "\n";
-        }
+    /*=================================================================================*/
+    //variation spreads players over the court: odd players run the mirrored route and
+    //every player starts further along the route and the loop
+    void loadPlayer(const std::shared_ptr<const AudioPlayer> &clip, int variation){
+        Player player;
+        player.convolver = std::make_shared<BinauralConvolver>();
+        player.convolver->prepare(hrtfBank, true);
+        player.firConvolver = std::make_shared<FirConvolver>();
+        player.firConvolver->prepare(hrirTapBank, samplesExpected);
+        player.interauralDelay = std::make_shared<InterauralDelay>();
+        player.encoder = std::make_shared<AmbisonicEncoder>();
         players.push_back(player);
 
+        //Odd players run the mirrored play, every player starts three waypoints further on
+        auto route = variation % 2 == 1 ? mirroredRoute : playerRoute;
+        sources.add(clip, (clip->getLength() / maxPlayers) * variation, route,
+                    route->getTimeAtWaypoint(variation * 3));
     }
 
 /*=================================================================================*/
-    void followRoute(Player &player){
-        static float distance = 0;
-        relativeTime1 += relativeTime1.milliseconds(10).inMilliseconds();
-        if ( relativeTime1.inMilliseconds() > 1000000.0f/3.0f) {
-            player.head = player.head->next;
-            std::cout << "Path Node: x: " << player.head->current.x << "y:" << player.head->current.y << "\n";
-            std::cout << "Path Node: Azimuth: " << vectorToSphere(player.head->current).azimuth << "\n";
-            std::cout << "Path Node: Radius: " << vectorToSphere(player.head->current).radius << "\n";
-            player.gain =  3/vectorToSphere(player.head->current).radius;
-            //Process gain for distance
-            std::cout << "Player Gain: " << .4 + player.gain << "\n";
-
-            //gainProcessorPlayer.processBlock(player.audioPlayer.buffer,emptyMidi);
-
-            auto hr = findClosestHRTF(vectorToSphere(player.head->current).azimuth);
-            player.hrtfIndex =hr;
-            player.bufferCurrent = zeroPlane.at(hr);
-            //std::cout << "HRTF index " << player.hrtfIndex << "\n";
-            relativeTime1 = relativeTime1.milliseconds(0);
-            distance = vectorToSphere(player.head->current).radius;
+    //Advances the source numSamples along its route on the scene clock, so motion does not
+    //depend on the block size. Constant time per call, moveSources places it afterwards.
+    void followRoute(int index, int numSamples){
+        const auto i = (size_t) index;
+        const double seconds = numSamples / sampleRate;
+        float x, y;
+
+        //A pinned player stays where the last command put it
+        if (sources.pinned[i]) {
+            x = sources.pinnedX[i];
+            y = sources.pinnedY[i];
+        } else {
+            auto &route = *sources.routes[i];
+            sources.routeSeconds[i] = std::fmod(sources.routeSeconds[i] + seconds, route.getDuration());
+            int segment = 0;
+            const auto point = route.getPosition(sources.routeSeconds[i], &segment);
+            x = point.x;
+            y = point.y;
+            if (segment != sources.routeSegments[i]) {
+                sources.routeSegments[i] = segment;
+                const auto &node = route.getWaypoint(segment);
+                audioLog.log(AudioLogMessages::routeNode, index, node.x, node.y,
+                             vectorToSphere(Position(node.x, node.y)).azimuth);
+            }
         }
 
+        sources.velocityX[i] = sources.pinned[i] ? 0.0f : (float) ((x - sources.x[i]) / seconds);
+        sources.velocityY[i] = sources.pinned[i] ? 0.0f : (float) ((y - sources.y[i]) / seconds);
+        sources.x[i] = x;
+        sources.y[i] = y;
     }
 
     /*=================================================================================*/
-    void findNearest(Player &player, int index){
-
-
-        for(int i =0; i < player.steps; i++)
-            player.head = player.head->next;
-//                std::cout << "Path Node: x: " << player.head->current.x << "y:" << player.head->current.y << "\n";
-//                std::cout << "Path Node: Azimuth: " << vectorToSphere(player.head->current).azimuth << "\n";
-//                std::cout << "Path Node: Radius: " << vectorToSphere(player.head->current).radius << "\n";
-        player.gain=  4/ vectorToSphere(player.head->current).radius;
-        auto hr = findClosestHRTF(vectorToSphere(player.head->current).azimuth);
-        player.hrtfIndex =hr;
-        player.bufferCurrent = zeroPlane.at(hr);
-//                std::cout << "HRTF index " << player.hrtfIndex << "\n";
-
 
+    //Moves the first numActive sources on numSamples, then updates distance gain, direction and
+    //HRTF handle for all of them in one pass per field. The convolvers read the banks directly.
+    void moveSources(int numActive, int numSamples){
+        for (int i = 0; i < numActive; ++i)
+            followRoute(i, numSamples);
+        sources.updateDirections(numActive);
+        sources.updateHrtfHandles(numActive, planeIndex);
     }
 
     //=========================================================================
     //========================Variables=========================================
     RelativeTime position;
-    RelativeTime relativeTime1;
     double sampleRate = 44100.0;
     MidiBuffer emptyMidi;
     int samplesExpected;
-    RelativeTime relativeTime;
-    int impulseIndex = 0;
-    int degrees = 0;
 
     std::vector<const int> elevations = {-45, -39, -34, -28, -23, -17, -11, -6, 0, 6, 11,
                                          17, 23, 28, 34, 39, 45, 51, 56, 62, 68, 73, 79,
@@ -1823,38 +1895,117 @@ private:
     //====================File and Resource loading=========================================
     AudioFormatManager formatManager;
     AudioFormatManager formatManager1;
+    AssetIndex assets;
     std::unique_ptr<AudioFormatReaderSource> readerSource;
     std::unique_ptr<AudioFormatReaderSource> readerSource1;
 
 //=====================Audio Sources=====================================================
     std::vector<AudioPlayer> audioList;
+    //Pre-spatialised at startup, in audioList order
+    struct StaticSound {
+        const char *fileName;
+        float azimuth;
+    };
+    const std::vector<StaticSound> staticSounds {{"CrowdDrumLoop.wav", 325.0f}, {"CrowdMediumClapping.wav", 150.0f}};
+    static constexpr float staticSoundGain = 0.05f;
+    RenderCache renderCache;
+    //Shared by every streaming voice, declared first so the voices go away before it
+    TimeSliceThread streamingThread { "Streaming voices" };
+    std::unique_ptr<StreamingVoice> ambience;
+    static constexpr float ambienceGain = 0.05f;
     std::unique_ptr<AudioTransportSource> transportSource;
     TransportState state;
 
+    //Published on the message thread, the audio thread works on its own copy
+    SceneSnapshot<SceneParameters> sceneSnapshot;
+    SceneParameters scene;
+    CommandQueue<SceneCommand, 256> guiCommands;
+
     //=====================Effects and processing=====================================================
     FilterProcessor filter;
-    std::unique_ptr<ConvolutionProcessor> convolutionProcessor;
-    std::unique_ptr<AudioSampleBuffer> inputL;
-    std::unique_ptr<AudioSampleBuffer> inputR;
+    HRTFSpectrumBank hrtfBank;
+    int plusSixBankOffset = 0;
+    int minusSixBankOffset = 0;
+    int sphereBankOffset = 0;
+    MinimumPhaseHrirSet minPhaseSet;
+    int minPhaseBankOffset = 0;
+    HrirPack hrirPack;
+    AmbisonicDecoder ambisonicDecoders[SphericalHarmonics::maxOrder];
 
     //=====================HRTF buffers and data stuctures=====================================================
-    std::vector<AudioSampleBuffer> rightVec;
-    std::vector<AudioSampleBuffer> leftVec;
-    std::vector<AudioSampleBuffer> rightVecNeg;
-    std::vector<AudioSampleBuffer> leftVecNeg;
-    std::vector<AudioSampleBuffer> leftHRIR;
-    std::vector<AudioSampleBuffer> rightHRIR;
     std::vector<HRTFData> plusSix;
     std::vector<HRTFData> minusSix;
     std::vector<HRTFData> zeroPlane;
-    std::map<int, std::map<int, HRTFData>> hrtfMap;
+    //Every measured direction, with its exact angles and triangulation
+    std::vector<HRTFData> sphere;
+    std::vector<Point<float>> sphereDirections;
+    HrtfSphere hrtfSphere;
+    //The HRIR set rebuilt from the WAVs, cleared once it is packed. Planes every planeAzimuthStep.
+    HrirGrid hrirGrid;
+    static constexpr float planeAzimuthStep = 5.0f;
+    //Optional offline grid, any azimuth step, loaded when no pack matches the subject48 WAVs
+    static constexpr const char *shippedHrirGrid = "HrirGrid.uphp";
+    File hrirPackOverride;
+    //Bank indices of the three planes by direction
+    HrtfIndex planeIndex;
+    //Only filled while the HRIR set is rebuilt from the WAVs
+    std::map<String, AudioSampleBuffer> decodedHrirs;
 
     //Gain Effects variables
     float rawVolume;
 
+    //Indexed alike, players holds each player's DSP state and sources where it is and what it plays
     std::vector<Player> players;
-    Player one;
-    int indexPast;
-    int lastAzimuthPos;
+    SourceStore sources;
+    static constexpr int maxPlayers = 32;
+    //Lap time of a route per waypoint, at the pace the players ran node to node
+    static constexpr double secondsPerRouteNode = 0.4;
+    //Loaded with the players, the mirrored route is for odd players
+    std::shared_ptr<const RouteSpline> playerRoute;
+    std::shared_ptr<const RouteSpline> mirroredRoute;
+    //Samples between player position, HRIR and gain updates
+    int controlInterval = 32;
+    //Samples rendered since play was pressed, only advanced by the audio thread
+    int64 sceneClock = 0;
+    std::atomic<int64> sceneSamples { 0 };
+    AudioSampleBuffer voiceScratch;
+    std::atomic<double> renderSecondsPerSource { 0.0 };
+    std::atomic<int> renderedSources { 0 };
+    Label renderCostLabel;
+    CallbackMonitor callbackMonitor;
+    //Audio thread diagnostics, formatted and written by the log's own thread
+    AudioLog audioLog;
+    Label callbackLoadLabel;
+    TextButton exportTimingButton;
+
+    //ComboBox ids of the player convolution backends
+    enum ConvolutionBackend {
+        backendAuto = 1,
+        backendFFT,
+        backendFIR
+    };
+    //Largest device block where auto prefers the direct FIR
+    static constexpr int firAutoMaxBlockSize = 256;
+    //Blend weights snap to multiples of 1 / blendSteps, a 32nd of 5 degrees is below what
+    //anyone hears
+    static constexpr float blendSteps = 32.0f;
+    HRIRTapBank hrirTapBank;
+    bool useFirBackend = false;
+    std::atomic<bool> renderedWithFir { false };
+    ComboBox backendBox;
+    Label backendLabel;
+    ToggleButton minimumPhaseToggle;
+
+    //ComboBox ids of the scene renderers, the Ambisonics ids follow the order
+    enum RenderMode {
+        renderBinaural = 1,
+        renderAmbisonicsFirst,
+        renderAmbisonicsSecond,
+        renderAmbisonicsThird
+    };
+    int activeRenderMode = renderBinaural;
+    std::atomic<int> renderedOrder { 0 };
+    ComboBox renderModeBox;
+    Label renderModeLabel;
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainContentComponent)
 };
\ No newline at end of file
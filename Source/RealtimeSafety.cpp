@@ -0,0 +1,139 @@
+/*==============================================================================
+//                      Realtime Safety hooks
+//      Replacements that report to RealtimeSafety before doing the real work
+//==============================================================================
+// - Linux with glibc: malloc, calloc, realloc and free forward to glibc's
+//   own entry points, pthread waits and file calls to the next definition
+//   found by the dynamic linker. That covers JUCE's HeapBlock, std::mutex,
+//   CriticalSection, WaitableEvent, std::cout and file streams.
+// - Elsewhere only the global operator new and delete are replaced.
+// - Only compiled into the app. Nothing here exists without
+//   UNDERPRESSURE_REALTIME_CHECKS.
+*/
+
+#include "RealtimeSafety.h"
+
+#if UNDERPRESSURE_REALTIME_CHECKS
+
+#if JUCE_LINUX && defined(__GLIBC__)
+
+#include <cstdarg>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+//The next definition after this executable's, each hook looks its own up once
+template <typename Function>
+static Function nextDefinition(const char *name) {
+    return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+}
+
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+void __libc_free(void *);
+
+void *malloc(size_t size) {
+    RealtimeSafety::check(RealtimeSafety::allocation);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    RealtimeSafety::check(RealtimeSafety::allocation);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+    RealtimeSafety::check(RealtimeSafety::allocation);
+    return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer) {
+    if (pointer != nullptr)
+        RealtimeSafety::check(RealtimeSafety::deallocation);
+    __libc_free(pointer);
+}
+
+/*=================================================================================*/
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+    static auto next = nextDefinition<int (*)(pthread_mutex_t *)>("pthread_mutex_lock");
+    RealtimeSafety::check(RealtimeSafety::lockWait);
+    return next(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t *condition, pthread_mutex_t *mutex) {
+    static auto next = nextDefinition<int (*)(pthread_cond_t *, pthread_mutex_t *)>("pthread_cond_wait");
+    RealtimeSafety::check(RealtimeSafety::lockWait);
+    return next(condition, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *condition, pthread_mutex_t *mutex, const struct timespec *time) {
+    static auto next = nextDefinition<int (*)(pthread_cond_t *, pthread_mutex_t *, const struct timespec *)>(
+            "pthread_cond_timedwait");
+    RealtimeSafety::check(RealtimeSafety::lockWait);
+    return next(condition, mutex, time);
+}
+
+/*=================================================================================*/
+
+ssize_t write(int file, const void *data, size_t size) {
+    static auto next = nextDefinition<ssize_t (*)(int, const void *, size_t)>("write");
+    RealtimeSafety::check(RealtimeSafety::fileIO);
+    return next(file, data, size);
+}
+
+ssize_t read(int file, void *data, size_t size) {
+    static auto next = nextDefinition<ssize_t (*)(int, void *, size_t)>("read");
+    RealtimeSafety::check(RealtimeSafety::fileIO);
+    return next(file, data, size);
+}
+
+//The mode is only passed on when the flags ask for it, like open itself reads it
+int open(const char *path, int flags, ...) {
+    static auto next = nextDefinition<int (*)(const char *, int, ...)>("open");
+    RealtimeSafety::check(RealtimeSafety::fileIO);
+    if ((flags & O_CREAT) == 0)
+        return next(path, flags);
+
+    va_list arguments;
+    va_start(arguments, flags);
+    const auto mode = (mode_t) va_arg(arguments, int);
+    va_end(arguments);
+    return next(path, flags, mode);
+}
+}
+
+#else
+
+void *operator new(std::size_t size) {
+    RealtimeSafety::check(RealtimeSafety::allocation);
+    if (auto *pointer = std::malloc(size == 0 ? 1 : size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+    RealtimeSafety::check(RealtimeSafety::allocation);
+    if (auto *pointer = std::malloc(size == 0 ? 1 : size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept {
+    if (pointer != nullptr)
+        RealtimeSafety::check(RealtimeSafety::deallocation);
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+    if (pointer != nullptr)
+        RealtimeSafety::check(RealtimeSafety::deallocation);
+    std::free(pointer);
+}
+
+#endif
+
+#endif
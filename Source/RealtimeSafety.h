@@ -0,0 +1,229 @@
+/*==============================================================================
+//                      Realtime Safety
+//      Debug checker for allocations, locks and I/O on the audio thread
+//==============================================================================
+// - The audio callback marks its thread for the scope of the callback.
+//   While a thread is marked, RealtimeSafety.cpp's hooks record every heap
+//   allocation or free, mutex or condition wait and file read or write.
+// - Each violation is recorded with its raw stack. Identical stacks share
+//   one slot with a count, so a violation that happens every block is one
+//   entry. Recording itself never allocates or locks.
+// - Stacks are symbolised only when the report is written, on the message
+//   thread. On Linux malloc, pthread and file calls are hooked, elsewhere
+//   only operator new and delete.
+// - On by default in debug builds, set UNDERPRESSURE_REALTIME_CHECKS to 0
+//   or 1 to override.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#ifndef UNDERPRESSURE_REALTIME_CHECKS
+ #if JUCE_DEBUG
+  #define UNDERPRESSURE_REALTIME_CHECKS 1
+ #else
+  #define UNDERPRESSURE_REALTIME_CHECKS 0
+ #endif
+#endif
+
+#if UNDERPRESSURE_REALTIME_CHECKS && (JUCE_LINUX || JUCE_MAC)
+ #include <execinfo.h>
+#endif
+
+//==============================================================================
+//              Realtime Safety
+//
+//==============================================================================
+
+class RealtimeSafety {
+public:
+    enum Violation {
+        allocation = 0,
+        deallocation,
+        lockWait,
+        fileIO,
+        numViolations
+    };
+
+    static constexpr int maxFrames = 24;
+    static constexpr int maxSites = 256;
+
+    //Marks the calling thread as real-time until the end of the scope, scopes may nest
+    struct ScopedRealtimeThread {
+       #if UNDERPRESSURE_REALTIME_CHECKS
+        ScopedRealtimeThread() { ++getThreadState().realtimeDepth; }
+        ~ScopedRealtimeThread() { --getThreadState().realtimeDepth; }
+       #endif
+    };
+
+    //Lets a marked thread do something knowingly unsafe, e.g. a debug print
+    struct ScopedAllowed {
+       #if UNDERPRESSURE_REALTIME_CHECKS
+        ScopedAllowed() { ++getThreadState().allowedDepth; }
+        ~ScopedAllowed() { --getThreadState().allowedDepth; }
+       #endif
+    };
+
+    /*=================================================================================*/
+
+    static bool isEnabled() { return UNDERPRESSURE_REALTIME_CHECKS != 0; }
+
+    static const char *getViolationName(int type) {
+        static const char *const names[] = {"Allocation", "Free", "Lock wait", "File I/O"};
+        return names[type];
+    }
+
+    //Called by the hooks on any thread, records the violation when the thread is marked
+    static void check(Violation type) noexcept {
+        auto &state = getThreadState();
+        if (state.realtimeDepth == 0 || state.allowedDepth > 0 || state.inCheck)
+            return;
+        state.inCheck = true;
+        record(type);
+        state.inCheck = false;
+    }
+
+    //Message thread, before the first callback. The first stack capture may load the
+    //unwinder and allocate, so it is done here once.
+    static void prepare() {
+       #if UNDERPRESSURE_REALTIME_CHECKS && (JUCE_LINUX || JUCE_MAC)
+        void *frames[maxFrames];
+        backtrace(frames, maxFrames);
+       #endif
+    }
+
+    /*=================================================================================*/
+
+    static int64 getNumViolations() { return getCounters().total.load(std::memory_order_relaxed); }
+
+    //Any thread but the marked ones. One entry per distinct stack, most frequent first.
+    static String getReport() {
+        struct Entry {
+            int type;
+            int64 count;
+            const Site *site;
+        };
+        std::vector<Entry> entries;
+        auto *sites = getSites();
+        for (int i = 0; i < maxSites; ++i)
+            if (sites[i].ready.load(std::memory_order_acquire))
+                entries.push_back({sites[i].type, sites[i].count.load(std::memory_order_relaxed), &sites[i]});
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.count > b.count; });
+
+        String report;
+        report << "Real-time safety: " << getNumViolations() << " violations at " << (int) entries.size()
+               << " sites";
+        if (auto dropped = getCounters().dropped.load(std::memory_order_relaxed))
+            report << ", " << dropped << " more at sites that did not fit";
+        report << "\n";
+
+        for (auto &entry : entries) {
+            report << "\n" << getViolationName(entry.type) << ", " << entry.count << " times\n";
+            report << symbolise(entry.site->frames, entry.site->numFrames);
+        }
+        return report;
+    }
+
+    static bool writeReport(const File &file) {
+        return file.replaceWithText(getReport());
+    }
+
+private:
+    struct ThreadState {
+        int realtimeDepth;
+        int allowedDepth;
+        bool inCheck;
+    };
+
+    //Zero initialised and trivially destructible, so safe to use inside malloc
+    struct Site {
+        std::atomic<uint64> hash;
+        std::atomic<int64> count;
+        std::atomic<bool> ready;
+        int type;
+        int numFrames;
+        void *frames[maxFrames];
+    };
+
+    struct Counters {
+        std::atomic<int64> total;
+        std::atomic<int64> dropped;
+    };
+
+    static ThreadState &getThreadState() {
+        static thread_local ThreadState state;
+        return state;
+    }
+
+    static Site *getSites() {
+        static Site sites[maxSites];
+        return sites;
+    }
+
+    static Counters &getCounters() {
+        static Counters counters;
+        return counters;
+    }
+
+    /*=================================================================================*/
+
+    //Open addressing on a hash of the violation type and stack, slots are never freed
+    static void record(Violation type) noexcept {
+        void *frames[maxFrames];
+        const int numFrames = captureFrames(frames);
+
+        uint64 hash = 14695981039346656037ull ^ (uint64) type;
+        for (int i = 0; i < numFrames; ++i)
+            hash = (hash ^ (uint64) (pointer_sized_uint) frames[i]) * 1099511628211ull;
+        hash = jmax((uint64) 1, hash);
+
+        getCounters().total.fetch_add(1, std::memory_order_relaxed);
+        auto *sites = getSites();
+        for (int probe = 0; probe < maxSites; ++probe) {
+            auto &site = sites[(hash + (uint64) probe) % maxSites];
+            uint64 expected = 0;
+            if (site.hash.compare_exchange_strong(expected, hash, std::memory_order_relaxed)) {
+                site.type = type;
+                site.numFrames = numFrames;
+                std::copy(frames, frames + numFrames, site.frames);
+                site.count.fetch_add(1, std::memory_order_relaxed);
+                site.ready.store(true, std::memory_order_release);
+                return;
+            }
+            if (expected == hash) {
+                site.count.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        getCounters().dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static int captureFrames(void **frames) {
+       #if UNDERPRESSURE_REALTIME_CHECKS && (JUCE_LINUX || JUCE_MAC)
+        return backtrace(frames, maxFrames);
+       #else
+        ignoreUnused(frames);
+        return 0;
+       #endif
+    }
+
+    //Allocates, never on a marked thread
+    static String symbolise(void *const *frames, int numFrames) {
+        String text;
+       #if UNDERPRESSURE_REALTIME_CHECKS && (JUCE_LINUX || JUCE_MAC)
+        if (auto **symbols = backtrace_symbols(frames, numFrames)) {
+            for (int i = 0; i < numFrames; ++i)
+                text << "    " << symbols[i] << "\n";
+            ::free(symbols);
+        }
+       #else
+        ignoreUnused(frames, numFrames);
+       #endif
+        if (text.isEmpty())
+            text << "    (no stack on this platform)\n";
+        return text;
+    }
+
+    RealtimeSafety() = delete;
+};
@@ -0,0 +1,151 @@
+/*==============================================================================
+//                      Render Cache
+//      Pre-spatialised static sounds stored on disk between runs
+//==============================================================================
+// - Entries are raw float files named after a 64 bit key. The key hashes
+//   everything the render depends on, so a stale entry is simply never found.
+// - Loading maps the file and copies the channels out, no decoding or
+//   convolution.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+//              Render Cache
+//
+//==============================================================================
+
+class RenderCache {
+public:
+    //Bump when the renderer changes so old stems are ignored
+    static constexpr uint32 formatVersion = 1;
+
+    //==============================================================================
+    //FNV-1a over everything that is added
+    class Key {
+    public:
+        Key &add(const void *data, size_t numBytes) {
+            auto *bytes = static_cast<const uint8 *>(data);
+            for (size_t i = 0; i < numBytes; ++i) {
+                value ^= bytes[i];
+                value *= 0x100000001b3ULL;
+            }
+            return *this;
+        }
+
+        Key &add(const String &text) { return add(text.toRawUTF8(), text.getNumBytesAsUTF8()); }
+
+        Key &add(int64 number) { return add(&number, sizeof(number)); }
+
+        Key &add(int number) { return add((int64) number); }
+
+        Key &add(double number) { return add(&number, sizeof(number)); }
+
+        Key &add(const float *samples, int numSamples) {
+            return add(static_cast<const void *>(samples), sizeof(float) * (size_t) numSamples);
+        }
+
+        //Path, size and modification time, the contents are not read
+        Key &add(const File &file) {
+            return add(file.getFullPathName()).add(file.getSize()).add(file.getLastModificationTime().toMilliseconds());
+        }
+
+        uint64 getValue() const { return value; }
+
+    private:
+        uint64 value = 0xcbf29ce484222325ULL;
+    };
+
+    //==============================================================================
+
+    RenderCache() : directory(File::getSpecialLocation(File::userApplicationDataDirectory)
+                                      .getChildFile("UnderPressure").getChildFile("RenderCache")) {}
+
+    /*=================================================================================*/
+
+    void setDirectory(const File &newDirectory) { directory = newDirectory; }
+
+    const File &getDirectory() const { return directory; }
+
+    File getFileFor(uint64 key) const { return directory.getChildFile(String::toHexString((int64) key) + ".uprc"); }
+
+    /*=================================================================================*/
+
+    //Fills dest and returns true if a valid entry of expectedNumSamples exists for the key
+    bool load(uint64 key, AudioSampleBuffer &dest, int expectedNumSamples) const {
+        auto file = getFileFor(key);
+        if (!file.existsAsFile())
+            return false;
+
+        MemoryMappedFile mapped(file, MemoryMappedFile::readOnly);
+        if (mapped.getData() == nullptr || mapped.getSize() < sizeof(Header))
+            return false;
+
+        Header header;
+        std::memcpy(&header, mapped.getData(), sizeof(Header));
+        if (std::memcmp(header.magic, "UPRC", 4) != 0 || header.version != formatVersion || header.key != key
+            || header.numChannels <= 0 || header.numSamples != expectedNumSamples)
+            return false;
+
+        auto channelBytes = sizeof(float) * (size_t) header.numSamples;
+        if (mapped.getSize() < sizeof(Header) + channelBytes * (size_t) header.numChannels)
+            return false;
+
+        dest.setSize(header.numChannels, header.numSamples);
+        auto *samples = static_cast<const char *>(mapped.getData()) + sizeof(Header);
+        for (int channel = 0; channel < header.numChannels; ++channel)
+            std::memcpy(dest.getWritePointer(channel), samples + channelBytes * (size_t) channel, channelBytes);
+
+        return true;
+    }
+
+    /*=================================================================================*/
+
+    //Written to a temporary file first so a crash never leaves a half written entry
+    bool store(uint64 key, const AudioSampleBuffer &source, double sampleRate) const {
+        if (directory.createDirectory().failed())
+            return false;
+
+        auto file = getFileFor(key);
+        TemporaryFile temp(file);
+        {
+            FileOutputStream out(temp.getFile());
+            if (out.failedToOpen())
+                return false;
+
+            Header header;
+            std::memcpy(header.magic, "UPRC", 4);
+            header.version = formatVersion;
+            header.numChannels = source.getNumChannels();
+            header.numSamples = source.getNumSamples();
+            header.key = key;
+            header.sampleRate = sampleRate;
+            out.write(&header, sizeof(Header));
+
+            for (int channel = 0; channel < source.getNumChannels(); ++channel)
+                out.write(source.getReadPointer(channel), sizeof(float) * (size_t) source.getNumSamples());
+
+            out.flush();
+            if (out.getStatus().failed())
+                return false;
+        }
+        return temp.overwriteTargetFileWithTemporary();
+    }
+
+private:
+    //Channel major float32 data follows the header
+    struct Header {
+        char magic[4];
+        uint32 version;
+        int32 numChannels;
+        int32 numSamples;
+        uint64 key;
+        double sampleRate;
+    };
+
+    File directory;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RenderCache)
+};
@@ -0,0 +1,217 @@
+/*==============================================================================
+//                      Route Spline
+//      Closed player route through waypoints, travelled at constant speed
+//==============================================================================
+// - Waypoints sit in one flat array. Each pair of neighbours is joined by a
+//   centripetal Catmull-Rom segment, stored as the cubic coefficients of its
+//   Hermite form, so the route passes through every waypoint without corners
+//   and without the loops uneven spacing gives a uniform spline.
+// - Segments are measured once on build. A table of spline parameters at
+//   evenly spaced distances turns a time into a position in constant time:
+//   one wrap, one table lerp and one cubic, no search and no allocation.
+// - Seeking by distance binary searches the cumulative segment lengths.
+// - Waypoints load from JSON, {"points": [[x, y], ...]} in metres, with the
+//   listener at the origin and y pointing ahead.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+//              Route Spline
+//
+//==============================================================================
+
+class RouteSpline {
+public:
+    //Integration steps when measuring a segment, and table entries per segment
+    static constexpr int stepsPerSegment = 16;
+    static constexpr int tableEntriesPerSegment = 16;
+
+    RouteSpline() {}
+
+    /*=================================================================================*/
+
+    void clear() {
+        waypoints.clear();
+        coefficients.clear();
+        cumulativeLengths.clear();
+        parameterTable.clear();
+        length = 0;
+        duration = 0;
+    }
+
+    //Before build. A waypoint on top of the previous one is skipped.
+    void addWaypoint(float x, float y) {
+        if (!waypoints.empty() && waypoints.back() == Point<float>(x, y))
+            return;
+        waypoints.push_back({x, y});
+    }
+
+    //Before build, e.g. the same play run on the other side of the court
+    void mirror() {
+        for (auto &point : waypoints)
+            point.x = -point.x;
+    }
+
+    //Replaces the waypoints, build has to be called again afterwards
+    Result loadJson(const File &file) {
+        if (!file.existsAsFile())
+            return Result::fail("no route file " + file.getFullPathName());
+
+        auto json = JSON::parse(file);
+        auto *points = json.getProperty("points", var()).getArray();
+        if (points == nullptr)
+            return Result::fail(file.getFileName() + " has no points array");
+
+        waypoints.clear();
+        for (auto &point : *points) {
+            if (!point.isArray() || point.size() < 2)
+                return Result::fail(file.getFileName() + " has a point that is not [x, y]");
+            addWaypoint((float) point[0], (float) point[1]);
+        }
+        return Result::ok();
+    }
+
+    /*=================================================================================*/
+
+    //Not real-time safe. One lap of the loop takes loopSeconds at constant speed.
+    void build(double loopSeconds) {
+        coefficients.clear();
+        cumulativeLengths.clear();
+        parameterTable.clear();
+        length = 0;
+        duration = jmax(1.0e-6, loopSeconds);
+
+        //The loop closes back onto the first waypoint
+        if (waypoints.size() > 1 && waypoints.back() == waypoints.front())
+            waypoints.pop_back();
+
+        const int numSegments = getNumSegments();
+        if (numSegments == 0)
+            return;
+
+        const int numWaypoints = (int) waypoints.size();
+        coefficients.resize((size_t) numSegments);
+        for (int i = 0; i < numSegments; ++i) {
+            auto &p0 = waypoints[(size_t) ((i + numWaypoints - 1) % numWaypoints)];
+            auto &p1 = waypoints[(size_t) i];
+            auto &p2 = waypoints[(size_t) ((i + 1) % numWaypoints)];
+            auto &p3 = waypoints[(size_t) ((i + 2) % numWaypoints)];
+
+            //Centripetal knot spacing, the square root of each chord
+            const float d0 = jmax(1.0e-4f, std::sqrt(p0.getDistanceFrom(p1)));
+            const float d1 = jmax(1.0e-4f, std::sqrt(p1.getDistanceFrom(p2)));
+            const float d2 = jmax(1.0e-4f, std::sqrt(p2.getDistanceFrom(p3)));
+            const auto m1 = ((p1 - p0) / d0 - (p2 - p0) / (d0 + d1) + (p2 - p1) / d1) * d1;
+            const auto m2 = ((p2 - p1) / d1 - (p3 - p1) / (d1 + d2) + (p3 - p2) / d2) * d1;
+
+            auto &segment = coefficients[(size_t) i];
+            segment.a = p1 * 2.0f - p2 * 2.0f + m1 + m2;
+            segment.b = p2 * 3.0f - p1 * 3.0f - m1 * 2.0f - m2;
+            segment.c = m1;
+            segment.d = p1;
+        }
+
+        //Chord lengths of the integration steps, cumulative over the whole loop
+        std::vector<float> stepLengths((size_t) (numSegments * stepsPerSegment + 1));
+        cumulativeLengths.resize((size_t) numSegments + 1);
+        for (int i = 0; i < numSegments; ++i) {
+            cumulativeLengths[(size_t) i] = length;
+            auto previous = evaluate(i, 0.0f);
+            for (int step = 1; step <= stepsPerSegment; ++step) {
+                auto next = evaluate(i, (float) step / stepsPerSegment);
+                length += previous.getDistanceFrom(next);
+                stepLengths[(size_t) (i * stepsPerSegment + step)] = length;
+                previous = next;
+            }
+        }
+        cumulativeLengths[(size_t) numSegments] = length;
+
+        //Parameter at every table distance, the last entry closes the loop
+        const int numEntries = numSegments * tableEntriesPerSegment;
+        entriesPerMetre = length > 0 ? numEntries / length : 0.0f;
+        parameterTable.resize((size_t) numEntries + 1);
+        int step = 1;
+        for (int entry = 0; entry <= numEntries; ++entry) {
+            const float distance = jmin(length, entry / jmax(1.0e-6f, entriesPerMetre));
+            while (step < (int) stepLengths.size() - 1 && stepLengths[(size_t) step] < distance)
+                ++step;
+            const float from = stepLengths[(size_t) step - 1];
+            const float span = stepLengths[(size_t) step] - from;
+            const float fraction = span > 0 ? (distance - from) / span : 0.0f;
+            parameterTable[(size_t) entry] = (step - 1 + jlimit(0.0f, 1.0f, fraction)) / stepsPerSegment;
+        }
+    }
+
+    /*=================================================================================*/
+
+    int getNumWaypoints() const { return (int) waypoints.size(); }
+    const Point<float> &getWaypoint(int index) const { return waypoints[(size_t) index]; }
+    float getLength() const { return length; }
+    double getDuration() const { return duration; }
+
+    //Time of the waypoint on the first lap, e.g. to start players further along the loop
+    double getTimeAtWaypoint(int index) const {
+        if (getNumSegments() == 0)
+            return 0;
+        return cumulativeLengths[(size_t) (index % getNumSegments())] / length * duration;
+    }
+
+    //O(log n). Segment the distance along the loop falls in, segment i leaves waypoint i.
+    int findSegment(float distance) const {
+        if (getNumSegments() == 0)
+            return 0;
+        auto it = std::upper_bound(cumulativeLengths.begin(), cumulativeLengths.end(), distance);
+        return jlimit(0, getNumSegments() - 1, (int) (it - cumulativeLengths.begin()) - 1);
+    }
+
+    //O(1), real-time safe. Wraps any time onto the loop, segment gets the segment it is on.
+    Point<float> getPosition(double seconds, int *segment = nullptr) const {
+        if (parameterTable.empty()) {
+            if (segment != nullptr)
+                *segment = 0;
+            return waypoints.empty() ? Point<float>() : waypoints.front();
+        }
+
+        double lap = std::fmod(seconds, duration);
+        if (lap < 0)
+            lap += duration;
+        const float entry = (float) (lap / duration) * (parameterTable.size() - 1);
+        const int index = jmin((int) entry, (int) parameterTable.size() - 2);
+        const float from = parameterTable[(size_t) index];
+        const float parameter = from + (parameterTable[(size_t) index + 1] - from) * (entry - index);
+
+        const int segmentIndex = jmin((int) parameter, getNumSegments() - 1);
+        if (segment != nullptr)
+            *segment = segmentIndex;
+        return evaluate(segmentIndex, parameter - segmentIndex);
+    }
+
+private:
+    struct Segment {
+        Point<float> a, b, c, d;
+    };
+
+    int getNumSegments() const { return waypoints.size() > 1 ? (int) waypoints.size() : 0; }
+
+    Point<float> evaluate(int segmentIndex, float u) const {
+        auto &segment = coefficients[(size_t) segmentIndex];
+        return ((segment.a * u + segment.b) * u + segment.c) * u + segment.d;
+    }
+
+    /*=================================================================================*/
+
+    std::vector<Point<float>> waypoints;
+    std::vector<Segment> coefficients;
+    //Distance at the start of each segment, plus the loop length at the end
+    std::vector<float> cumulativeLengths;
+    //Spline parameter, segment plus fraction, at evenly spaced distances
+    std::vector<float> parameterTable;
+    float entriesPerMetre = 0;
+    float length = 0;
+    double duration = 0;
+
+    JUCE_LEAK_DETECTOR (RouteSpline)
+};
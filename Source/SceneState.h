@@ -0,0 +1,136 @@
+/*==============================================================================
+//                      Scene State Handoff
+//      Wait-free transfer of parameters and commands to the audio thread
+//==============================================================================
+// - SceneSnapshot is a triple buffer: the producer always has a free slot to
+//   write, the audio thread picks up the newest complete one at block start.
+// - CommandQueue is a single producer, single consumer FIFO for discrete
+//   updates. Every producer thread gets its own queue.
+// - Neither side ever blocks or allocates after construction.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+//              Scene Parameters
+//              Everything the audio thread used to read from the widgets
+//==============================================================================
+
+struct SceneParameters {
+    bool playing = false;
+    int numPlayers = 1;
+    double crowdSize = 100;
+    int renderMode = 1;
+    int convolutionBackend = 1;
+    bool minimumPhase = false;
+    //Samples between position, HRIR and gain updates
+    int controlInterval = 32;
+};
+
+//==============================================================================
+//              Scene Command
+//              Discrete per player update
+//==============================================================================
+
+struct SceneCommand {
+    enum Type {
+        setPlayerPosition,  //holds the player at x, y instead of its route
+        releasePlayer,      //the player follows its route again
+        setPlayerTrim,      //extra gain on top of the distance gain
+        setPlayerElevation  //degrees above ear height in value
+    };
+
+    Type type = releasePlayer;
+    int player = 0;
+    float x = 0;
+    float y = 0;
+    float value = 1;
+};
+
+//==============================================================================
+//              Scene Snapshot
+//              Triple buffer, one writer thread and one reader thread
+//==============================================================================
+
+template <typename State>
+class SceneSnapshot {
+public:
+    SceneSnapshot() {}
+
+    /*=================================================================================*/
+
+    //Writer thread only. Never waits, an unread snapshot is simply replaced.
+    void publish(const State &state) {
+        slots[writeSlot] = state;
+        writeSlot = shared.exchange(writeSlot | freshFlag, std::memory_order_acq_rel) & slotMask;
+    }
+
+    /*=================================================================================*/
+
+    //Reader thread only. The returned state stays valid until the next call.
+    const State &acquire() {
+        if (shared.load(std::memory_order_relaxed) & freshFlag)
+            readSlot = shared.exchange(readSlot, std::memory_order_acq_rel) & slotMask;
+        return slots[readSlot];
+    }
+
+private:
+    static constexpr int slotMask = 3;
+    static constexpr int freshFlag = 4;
+
+    State slots[3];
+    int writeSlot = 0;
+    int readSlot = 1;
+    std::atomic<int> shared { 2 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SceneSnapshot)
+};
+
+//==============================================================================
+//              Command Queue
+//              Fixed size SPSC FIFO on top of AbstractFifo
+//==============================================================================
+
+template <typename Command, int capacity>
+class CommandQueue {
+public:
+    CommandQueue() {}
+
+    /*=================================================================================*/
+
+    //Producer thread only. Returns false when the queue is full and the command was dropped.
+    bool push(const Command &command) {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(1, start1, size1, start2, size2);
+        if (size1 + size2 == 0)
+            return false;
+
+        commands[(size_t) (size1 > 0 ? start1 : start2)] = command;
+        fifo.finishedWrite(1);
+        return true;
+    }
+
+    /*=================================================================================*/
+
+    //Consumer thread only. Calls handler for every command queued so far, in order.
+    template <typename Handler>
+    void drain(Handler &&handler) {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(fifo.getNumReady(), start1, size1, start2, size2);
+
+        for (int i = 0; i < size1; ++i)
+            handler(commands[(size_t) (start1 + i)]);
+        for (int i = 0; i < size2; ++i)
+            handler(commands[(size_t) (start2 + i)]);
+
+        fifo.finishedRead(size1 + size2);
+    }
+
+private:
+    AbstractFifo fifo { capacity };
+    std::array<Command, (size_t) capacity> commands;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CommandQueue)
+};
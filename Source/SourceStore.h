@@ -0,0 +1,153 @@
+/*==============================================================================
+//                      Source Store
+//      Motion, placement and playback state of every player, one array per field
+//==============================================================================
+// - Players are indices into parallel arrays, so a control interval walks a
+//   few contiguous float arrays instead of hopping from Player to Player past
+//   clips and convolvers.
+// - Distance gain and azimuth are updated for all active sources in one
+//   branch free pass per field, which the compiler vectorises. The azimuth
+//   uses a polynomial arctangent, so no libm call blocks it. HRTF handles
+//   follow in a pass of constant time lookups.
+// - Samples are shared: a source holds a pointer to one immutable clip and
+//   route plus its own play head and route time, a few dozen bytes in all.
+// - Sized when the players load, nothing allocates afterwards. The per
+//   source DSP state stays with Player, indexed the same way.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "HrtfIndex.h"
+#include "RouteSpline.h"
+
+struct AudioPlayer;
+
+//==============================================================================
+//              Source Store
+//
+//==============================================================================
+
+class SourceStore {
+public:
+    SourceStore() {}
+
+    /*=================================================================================*/
+
+    int size() const { return (int) x.size(); }
+
+    void clear() {
+        resize(0);
+        clips.clear();
+        routes.clear();
+    }
+
+    //Not real-time safe. Returns the new source's index.
+    int add(std::shared_ptr<const AudioPlayer> clip, int startSample, std::shared_ptr<const RouteSpline> route,
+            double startSeconds) {
+        const int index = size();
+        resize(index + 1);
+        clips.push_back(std::move(clip));
+        routes.push_back(std::move(route));
+        playHeads[(size_t) index] = startSample;
+        routeSeconds[(size_t) index] = startSeconds;
+        if (auto *spline = routes.back().get()) {
+            auto point = spline->getPosition(startSeconds, &routeSegments[(size_t) index]);
+            x[(size_t) index] = point.x;
+            y[(size_t) index] = point.y;
+        }
+        return index;
+    }
+
+    /*=================================================================================*/
+
+    //Distance, distance gain and azimuth of the first numSources from their positions.
+    //Azimuth matches vectorToSphere, atan(x / y) in degrees wrapped to 0..360, so sources
+    //behind the listener mirror onto the front. A source on the listener is minimumDistance
+    //away at azimuth 45 rather than inf or NaN.
+    void updateDirections(int numSources) {
+        const float *xs = x.data();
+        const float *ys = y.data();
+        float *distances = distance.data();
+        float *gains = gain.data();
+        float *azimuths = azimuth.data();
+
+        for (int i = 0; i < numSources; ++i)
+            distances[i] = jmax(minimumDistance, std::sqrt(xs[i] * xs[i] + ys[i] * ys[i]));
+        for (int i = 0; i < numSources; ++i)
+            gains[i] = distanceGain / distances[i];
+
+        //atan(|x / y|) is 45 degrees plus atan of t below, which stays within -1..1 even at
+        //y = 0. The sign of x * y picks the quadrant, copysign keeps the loop free of compares.
+        for (int i = 0; i < numSources; ++i) {
+            const float absX = std::abs(xs[i]);
+            const float absY = std::abs(ys[i]);
+            const float t = (absX - absY) / jmax(std::numeric_limits<float>::min(), absX + absY);
+            const float degrees = 45.0f + atanDegrees(t);
+            const float wraps = 0.5f - 0.5f * std::copysign(1.0f, xs[i] * ys[i]);
+            azimuths[i] = degrees + wraps * (360.0f - 2.0f * degrees);
+        }
+    }
+
+    void updateHrtfHandles(int numSources, const HrtfIndex &index) {
+        for (int i = 0; i < numSources; ++i)
+            hrtf[(size_t) i] = index.findNearest(azimuth[(size_t) i], elevation[(size_t) i]);
+    }
+
+    /*=================================================================================*/
+
+    //Gain at one metre, the level falls off as one over the distance
+    static constexpr float distanceGain = 3.0f;
+    //About the radius of the head, the level stops rising inside it
+    static constexpr float minimumDistance = 0.1f;
+
+    //Metres, listener at the origin and y pointing ahead
+    std::vector<float> x, y;
+    //Metres per second over the last control interval
+    std::vector<float> velocityX, velocityY;
+
+    std::vector<float> distance;
+    std::vector<float> gain;
+    //Degrees
+    std::vector<float> azimuth;
+    std::vector<float> elevation;
+    std::vector<HrtfHandle> hrtf;
+
+    //Set through SceneCommands
+    std::vector<float> trim;
+    std::vector<uint8> pinned;
+    std::vector<float> pinnedX, pinnedY;
+
+    //Gain the last rendered sub-block ended on, the next one ramps from it
+    std::vector<float> mixGain;
+    std::vector<int> playHeads;
+    //Scene clock seconds along the route, wrapped to one lap, and the segment last placed on
+    std::vector<double> routeSeconds;
+    std::vector<int> routeSegments;
+
+    //Shared with every source playing the same clip or running the same play
+    std::vector<std::shared_ptr<const AudioPlayer>> clips;
+    std::vector<std::shared_ptr<const RouteSpline>> routes;
+
+private:
+    //Odd minimax polynomial for -1..1, within 0.001 degrees
+    static float atanDegrees(float t) {
+        const float t2 = t * t;
+        return t * (57.28810f + t2 * (-18.92475f + t2 * (10.32132f + t2 * (-4.877762f + t2 * 1.193764f))));
+    }
+
+    void resize(int numSources) {
+        const auto count = (size_t) numSources;
+        for (auto *field : {&x, &y, &velocityX, &velocityY, &distance, &gain, &azimuth, &elevation, &pinnedX,
+                            &pinnedY, &mixGain})
+            field->resize(count, 0.0f);
+        trim.resize(count, 1.0f);
+        pinned.resize(count, 0);
+        hrtf.resize(count);
+        playHeads.resize(count, 0);
+        routeSeconds.resize(count, 0.0);
+        routeSegments.resize(count, 0);
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SourceStore)
+};
@@ -0,0 +1,125 @@
+/*==============================================================================
+//                      Startup Graph
+//      Loading work as a dependency graph run on a thread pool
+//==============================================================================
+// - Every task names the tasks it waits for. Tasks with nothing left to wait
+//   for are queued on the pool straight away, so independent loads overlap.
+// - run() blocks the calling thread until the whole graph is done.
+// - Each task's start and end are recorded for the timing report, so cold
+//   start time can be tracked as the asset set grows.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+//              Startup Graph
+//
+//==============================================================================
+
+class StartupGraph {
+public:
+    explicit StartupGraph(int numThreads = jmax(1, SystemStats::getNumCpus())) : pool(numThreads) {}
+
+    ~StartupGraph() {
+        pool.removeAllJobs(false, 10000);
+    }
+
+    /*=================================================================================*/
+
+    //Returns the task's id for later dependencies. Only call before run.
+    int add(const String &name, std::function<void()> work, const std::vector<int> &dependencies = {}) {
+        const int id = (int) tasks.size();
+        tasks.emplace_back(new Task());
+        auto &task = *tasks.back();
+        task.name = name;
+        task.work = std::move(work);
+        task.waitingFor = (int) dependencies.size();
+
+        for (auto dependency : dependencies) {
+            jassert(isPositiveAndBelow(dependency, id));
+            tasks[(size_t) dependency]->dependents.push_back(id);
+        }
+        return id;
+    }
+
+    /*=================================================================================*/
+
+    //Runs every task once its dependencies are done and waits for the last one
+    void run() {
+        remaining = (int) tasks.size();
+        startTicks = Time::getHighResolutionTicks();
+
+        for (int id = 0; id < (int) tasks.size(); ++id)
+            if (tasks[(size_t) id]->waitingFor == 0)
+                queue(id);
+
+        if (!tasks.empty())
+            finished.wait();
+        totalSeconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks);
+    }
+
+    /*=================================================================================*/
+
+    //One line per task in the order they started, times in ms from the start of run
+    String getReport() const {
+        std::vector<const Task *> order;
+        for (auto &task : tasks)
+            order.push_back(task.get());
+        std::sort(order.begin(), order.end(), [](const Task *a, const Task *b) { return a->start < b->start; });
+
+        String report;
+        report << "Startup: " << (int) tasks.size() << " tasks on " << pool.getNumThreads() << " threads, "
+               << String(totalSeconds * 1000.0, 1) << " ms\n";
+        for (auto *task : order)
+            report << "  " << String(task->start * 1000.0, 1).paddedLeft(' ', 8) << " ms +"
+                   << String((task->end - task->start) * 1000.0, 1).paddedLeft(' ', 8) << " ms  " << task->name << "\n";
+        return report;
+    }
+
+    double getTotalSeconds() const { return totalSeconds; }
+
+private:
+    struct Task {
+        String name;
+        std::function<void()> work;
+        std::vector<int> dependents;
+        std::atomic<int> waitingFor { 0 };
+        double start = 0;
+        double end = 0;
+    };
+
+    /*=================================================================================*/
+
+    void queue(int id) {
+        pool.addJob([this, id] {
+            auto &task = *tasks[(size_t) id];
+            task.start = secondsSinceStart();
+            task.work();
+            task.end = secondsSinceStart();
+
+            for (auto dependent : task.dependents)
+                if (--tasks[(size_t) dependent]->waitingFor == 0)
+                    queue(dependent);
+
+            if (--remaining == 0)
+                finished.signal();
+        });
+    }
+
+    double secondsSinceStart() const {
+        return Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks);
+    }
+
+    /*=================================================================================*/
+
+    ThreadPool pool;
+    std::vector<std::unique_ptr<Task>> tasks;
+    std::atomic<int> remaining { 0 };
+    WaitableEvent finished;
+    int64 startTicks = 0;
+    double totalSeconds = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (StartupGraph)
+};
@@ -0,0 +1,246 @@
+/*==============================================================================
+//                      Streaming Voice
+//      Long looped clips played from disk through a small read-ahead ring
+//==============================================================================
+// - All voices share one TimeSliceThread that keeps their rings topped up, the
+//   audio thread only ever reads from the rings.
+// - The first read-ahead worth of the clip is kept in memory, so a trigger
+//   plays from the preload at once while the reader seeks past it.
+// - Reads wrap at the loop point on the I/O thread, the ring never sees it.
+// - Offline, the voice reads inline instead, so rendering faster than real
+//   time never outruns the disk.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+//              Streaming Voice
+//              One reader, one preload and one SPSC ring per clip
+//==============================================================================
+
+class StreamingVoice : public TimeSliceClient {
+public:
+    //The ring holds this many device blocks, and never less than minReadAhead samples
+    static constexpr int readAheadBlocks = 16;
+    static constexpr int minReadAhead = 8192;
+
+    explicit StreamingVoice(TimeSliceThread &ioThread) : thread(ioThread) {}
+
+    ~StreamingVoice() {
+        thread.removeTimeSliceClient(this);
+    }
+
+    /*=================================================================================*/
+
+    //Offline renders fill the ring on the rendering thread whenever it runs short, so the
+    //I/O thread is never used. Call before open.
+    void setReadInline(bool shouldReadInline) { readInline = shouldReadInline; }
+
+    /*=================================================================================*/
+
+    //Not real-time safe, call before playback. Only the preload is decoded here, the voice
+    //owns the reader and only the I/O thread uses it afterwards.
+    bool open(std::unique_ptr<AudioFormatReader> newReader, int blockSize) {
+        thread.removeTimeSliceClient(this);
+        playing = false;
+
+        reader = std::move(newReader);
+        if (reader == nullptr)
+            return false;
+
+        length = (int) jmin(reader->lengthInSamples, (int64) std::numeric_limits<int>::max());
+        const int readAhead = jmax(minReadAhead, blockSize * readAheadBlocks);
+        preloadLength = jmin(length, readAhead);
+
+        preload.setSize(2, preloadLength);
+        reader->read(&preload, 0, preloadLength, 0, true, true);
+
+        ring.setSize(2, readAhead);
+        ring.clear();
+        fifo.setTotalSize(readAhead);
+        fifo.reset();
+
+        totalWritten = totalRead = 0;
+        staleEnd.store(0);
+        servedGeneration = generation = 0;
+        requestedGeneration.store(0);
+        servedAck.store(0);
+        filePos = preloadLength % jmax(1, length);
+
+        //Clips that fit in the preload loop from memory and never touch the thread
+        if (isStreamed() && !readInline)
+            thread.addTimeSliceClient(this);
+        return true;
+    }
+
+    /*=================================================================================*/
+
+    //Audio thread. Plays from the top of the clip starting with the next addTo. Nothing wakes
+    //the I/O thread, notify takes a lock; it sees the new generation on its next poll, well
+    //within the preload.
+    void trigger() {
+        if (reader == nullptr)
+            return;
+
+        preloadPos = 0;
+        ringReady = false;
+        playing = true;
+        requestedGeneration.store(++generation, std::memory_order_release);
+    }
+
+    void stop() { playing = false; }
+
+    bool isPlaying() const { return playing; }
+
+    //Blocks where the ring had run dry, the rest of those blocks was left silent
+    int getNumUnderruns() const { return underruns.load(); }
+
+    /*=================================================================================*/
+
+    //Audio thread. Adds numSamples of the looped clip to both channels of dest with gain.
+    void addTo(AudioSampleBuffer &dest, int startSample, int numSamples, float gain) {
+        play(&dest, startSample, numSamples, gain);
+    }
+
+    //Moves on numSamples as addTo would without mixing anything, for seeking offline renders
+    void skip(int numSamples) {
+        play(nullptr, 0, numSamples, 0.0f);
+    }
+
+    /*=================================================================================*/
+
+    //I/O thread. Restarts after a trigger, otherwise fills whatever space the ring has.
+    int useTimeSlice() override {
+        auto requested = requestedGeneration.load(std::memory_order_acquire);
+        if (requested != servedGeneration) {
+            servedGeneration = requested;
+            staleEnd.store(totalWritten, std::memory_order_relaxed);
+            filePos = preloadLength % length;
+            servedAck.store(requested, std::memory_order_release);
+        }
+
+        int free = fifo.getFreeSpace();
+        if (free == 0)
+            return idleWaitMs;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(free, start1, size1, start2, size2);
+        readLooped(start1, size1);
+        readLooped(start2, size2);
+        fifo.finishedWrite(size1 + size2);
+        totalWritten += size1 + size2;
+
+        return busyWaitMs;
+    }
+
+private:
+    /*=================================================================================*/
+
+    //Mixes into dest unless it is null
+    void play(AudioSampleBuffer *dest, int startSample, int numSamples, float gain) {
+        if (!playing)
+            return;
+
+        for (int done = 0; done < numSamples;) {
+            //The head of the clip always comes from memory
+            if (preloadPos < preloadLength) {
+                int num = jmin(numSamples - done, preloadLength - preloadPos);
+                for (int channel = 0; channel < 2 && dest != nullptr; ++channel)
+                    dest->addFrom(channel, startSample + done, preload, channel, preloadPos, num, gain);
+
+                preloadPos += num;
+                done += num;
+                if (!isStreamed() && preloadPos == preloadLength)
+                    preloadPos = 0;
+                continue;
+            }
+
+            //Drop whatever the reader wrote before it saw the last trigger
+            if (!ringReady) {
+                if (readInline)
+                    useTimeSlice();
+                if (servedAck.load(std::memory_order_acquire) != generation) {
+                    underruns++;
+                    return;
+                }
+                auto stale = (int) (staleEnd.load(std::memory_order_relaxed) - totalRead);
+                fifo.finishedRead(stale);
+                totalRead += stale;
+                ringReady = true;
+            }
+
+            if (readInline && fifo.getNumReady() < numSamples - done)
+                useTimeSlice();
+
+            int num = jmin(numSamples - done, fifo.getNumReady());
+            if (num == 0) {
+                underruns++;
+                return;
+            }
+
+            int start1, size1, start2, size2;
+            fifo.prepareToRead(num, start1, size1, start2, size2);
+            for (int channel = 0; channel < 2 && dest != nullptr; ++channel) {
+                dest->addFrom(channel, startSample + done, ring, channel, start1, size1, gain);
+                if (size2 > 0)
+                    dest->addFrom(channel, startSample + done + size1, ring, channel, start2, size2, gain);
+            }
+            fifo.finishedRead(num);
+            totalRead += num;
+            done += num;
+        }
+    }
+
+    /*=================================================================================*/
+
+    bool isStreamed() const { return length > preloadLength; }
+
+    //Reads num samples into the ring, wrapping the file at the loop point
+    void readLooped(int ringStart, int num) {
+        while (num > 0) {
+            int span = jmin(num, length - filePos);
+            reader->read(&ring, ringStart, span, filePos, true, true);
+            filePos = (filePos + span) % length;
+            ringStart += span;
+            num -= span;
+        }
+    }
+
+    /*=================================================================================*/
+
+    //Longest a trigger waits to be seen, the preload covers far more than this
+    static constexpr int idleWaitMs = 10;
+    static constexpr int busyWaitMs = 1;
+
+    TimeSliceThread &thread;
+    std::unique_ptr<AudioFormatReader> reader;
+    AudioSampleBuffer preload;
+    AudioSampleBuffer ring;
+    AbstractFifo fifo { 1 };
+
+    int length = 0;
+    int preloadLength = 0;
+
+    bool readInline = false;
+
+    //Audio thread
+    bool playing = false;
+    bool ringReady = false;
+    int preloadPos = 0;
+    int generation = 0;
+    int64 totalRead = 0;
+
+    //I/O thread
+    int servedGeneration = 0;
+    int filePos = 0;
+    int64 totalWritten = 0;
+
+    std::atomic<int> requestedGeneration { 0 };
+    std::atomic<int> servedAck { 0 };
+    std::atomic<int64> staleEnd { 0 };
+    std::atomic<int> underruns { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (StreamingVoice)
+};
@@ -0,0 +1,204 @@
+/*==============================================================================
+//                      Benchmark
+//      Timing, percentiles and cycle counts for one benchmark case at a time
+//==============================================================================
+// - A case is a named body run once per iteration, usually one block of one
+//   sample rate and block size for some number of sources.
+// - Every iteration is timed on its own, so the percentiles show the spikes
+//   an audio callback would see and not just the mean.
+// - Cycles come from the time stamp counter on Intel, elsewhere they are
+//   estimated from the nominal clock speed.
+// - Results go to CSV and JSON with one row per case, so runs can be diffed.
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#if JUCE_INTEL
+ #if JUCE_MSVC
+  #include <intrin.h>
+ #else
+  #include <x86intrin.h>
+ #endif
+#endif
+
+//==============================================================================
+//              Benchmark Runner
+//
+//==============================================================================
+
+class BenchmarkRunner {
+public:
+    //blockSize 0 marks a load time step, timed per call rather than per sample
+    struct Case {
+        String name;
+        double sampleRate;
+        int blockSize;
+        int numSources;
+    };
+
+    struct Result {
+        Case benchmark;
+        int iterations;
+        double meanNs;
+        double p50Ns;
+        double p90Ns;
+        double p99Ns;
+        double maxNs;
+        double nsPerSample;
+        double nsPerSourceSample;
+        double cyclesPerSourceSample;
+    };
+
+    BenchmarkRunner(double secondsPerCase, int minIterations, const String &nameFilter)
+        : targetSeconds(secondsPerCase), minimumIterations(minIterations), filter(nameFilter) {}
+
+    /*=================================================================================*/
+
+    bool isWanted(const String &name) const {
+        return filter.isEmpty() || name.containsIgnoreCase(filter);
+    }
+
+    //Runs body until both the minimum iterations and the time per case are reached, after a
+    //few untimed warm up runs
+    void run(const Case &benchmark, const std::function<void()> &body) {
+        for (int i = 0; i < warmUpIterations; ++i)
+            body();
+
+        std::vector<double> nanoseconds;
+        double cycles = 0, elapsed = 0;
+        while ((int) nanoseconds.size() < minimumIterations || elapsed < targetSeconds) {
+            const auto startCycles = readCycleCounter();
+            const auto startTicks = Time::getHighResolutionTicks();
+            body();
+            const auto seconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks);
+            cycles += (double) (readCycleCounter() - startCycles);
+
+            nanoseconds.push_back(seconds * 1.0e9);
+            elapsed += seconds;
+            if ((int) nanoseconds.size() >= maxIterations)
+                break;
+        }
+
+        Result result;
+        result.benchmark = benchmark;
+        result.iterations = (int) nanoseconds.size();
+        result.meanNs = elapsed * 1.0e9 / result.iterations;
+        std::sort(nanoseconds.begin(), nanoseconds.end());
+        result.p50Ns = percentile(nanoseconds, 0.5);
+        result.p90Ns = percentile(nanoseconds, 0.9);
+        result.p99Ns = percentile(nanoseconds, 0.99);
+        result.maxNs = nanoseconds.back();
+
+        const double samples = (double) jmax(1, benchmark.blockSize);
+        const double sourceSamples = samples * jmax(1, benchmark.numSources);
+        if (!hasCycleCounter())
+            cycles = elapsed * SystemStats::getCpuSpeedInMegahertz() * 1.0e6;
+        result.nsPerSample = result.meanNs / samples;
+        result.nsPerSourceSample = result.meanNs / sourceSamples;
+        result.cyclesPerSourceSample = cycles / result.iterations / sourceSamples;
+
+        results.push_back(result);
+        std::cout << describe(result) << "\n";
+    }
+
+    /*=================================================================================*/
+
+    const std::vector<Result> &getResults() const { return results; }
+
+    static String describe(const Result &result) {
+        auto &benchmark = result.benchmark;
+        String line = benchmark.name.paddedRight(' ', 22);
+        line << String(benchmark.sampleRate / 1000.0, 1).paddedLeft(' ', 5) << " kHz"
+             << String(benchmark.blockSize).paddedLeft(' ', 6) << " smp"
+             << String(benchmark.numSources).paddedLeft(' ', 5) << " src  "
+             << "p50 " << String(result.p50Ns / 1000.0, 1).paddedLeft(' ', 9) << " us  "
+             << "p99 " << String(result.p99Ns / 1000.0, 1).paddedLeft(' ', 9) << " us  "
+             << String(result.nsPerSourceSample, 2).paddedLeft(' ', 9) << " ns/src/smp  "
+             << String(result.cyclesPerSourceSample, 1).paddedLeft(' ', 8) << " cyc/src/smp";
+        return line;
+    }
+
+    /*=================================================================================*/
+
+    bool writeCsv(const File &file) const {
+        String csv = "benchmark,sampleRate,blockSize,sources,iterations,meanNs,p50Ns,p90Ns,p99Ns,maxNs,"
+                     "nsPerSample,nsPerSourceSample,cyclesPerSourceSample\n";
+        for (auto &result : results) {
+            auto &benchmark = result.benchmark;
+            csv << benchmark.name << "," << benchmark.sampleRate << "," << benchmark.blockSize << ","
+                << benchmark.numSources << "," << result.iterations << "," << result.meanNs << ","
+                << result.p50Ns << "," << result.p90Ns << "," << result.p99Ns << "," << result.maxNs << ","
+                << result.nsPerSample << "," << result.nsPerSourceSample << "," << result.cyclesPerSourceSample << "\n";
+        }
+        return file.replaceWithText(csv);
+    }
+
+    //The machine is recorded with the results, comparisons across machines need it
+    bool writeJson(const File &file) const {
+        auto *root = new DynamicObject();
+        root->setProperty("cpu", SystemStats::getCpuModel());
+        root->setProperty("cpuMHz", SystemStats::getCpuSpeedInMegahertz());
+        root->setProperty("numCpus", SystemStats::getNumCpus());
+        root->setProperty("os", SystemStats::getOperatingSystemName());
+        root->setProperty("cycleCounter", hasCycleCounter());
+        root->setProperty("date", Time::getCurrentTime().toISO8601(true));
+
+        Array<var> rows;
+        for (auto &result : results) {
+            auto *row = new DynamicObject();
+            row->setProperty("benchmark", result.benchmark.name);
+            row->setProperty("sampleRate", result.benchmark.sampleRate);
+            row->setProperty("blockSize", result.benchmark.blockSize);
+            row->setProperty("sources", result.benchmark.numSources);
+            row->setProperty("iterations", result.iterations);
+            row->setProperty("meanNs", result.meanNs);
+            row->setProperty("p50Ns", result.p50Ns);
+            row->setProperty("p90Ns", result.p90Ns);
+            row->setProperty("p99Ns", result.p99Ns);
+            row->setProperty("maxNs", result.maxNs);
+            row->setProperty("nsPerSample", result.nsPerSample);
+            row->setProperty("nsPerSourceSample", result.nsPerSourceSample);
+            row->setProperty("cyclesPerSourceSample", result.cyclesPerSourceSample);
+            rows.add(var(row));
+        }
+        root->setProperty("results", rows);
+        return file.replaceWithText(JSON::toString(var(root)));
+    }
+
+private:
+    static constexpr int warmUpIterations = 3;
+    static constexpr int maxIterations = 100000;
+
+    static bool hasCycleCounter() {
+       #if JUCE_INTEL
+        return true;
+       #else
+        return false;
+       #endif
+    }
+
+    static uint64 readCycleCounter() {
+       #if JUCE_INTEL
+        return (uint64) __rdtsc();
+       #else
+        return 0;
+       #endif
+    }
+
+    //Nearest rank on sorted values
+    static double percentile(const std::vector<double> &sorted, double fraction) {
+        const auto rank = (size_t) jlimit(0.0, (double) sorted.size() - 1, std::ceil(fraction * sorted.size()) - 1);
+        return sorted[rank];
+    }
+
+    /*=================================================================================*/
+
+    double targetSeconds;
+    int minimumIterations;
+    String filter;
+    std::vector<Result> results;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BenchmarkRunner)
+};
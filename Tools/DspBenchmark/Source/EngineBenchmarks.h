@@ -0,0 +1,383 @@
+/*==============================================================================
+//                      Engine Benchmarks
+//      The app's DSP steps timed one at a time on a prepared engine
+//==============================================================================
+// - The engine is a MainContentComponent made without an audio device and
+//   prepared for one sample rate and block size, so every step runs on the
+//   banks, index and players the app itself would use.
+// - Per block steps run for a number of sources, each moving around the
+//   listener so HRTF lookups and crossfades happen as in a scene. The sources
+//   are split into control interval sub-blocks like renderPlayers does.
+// - Load steps have block size 0 and are timed per call.
+*/
+
+#pragma once
+
+#include "../../../Source/MainComponent.h"
+#include "Benchmark.h"
+
+//==============================================================================
+//              Engine Benchmarks
+//
+//==============================================================================
+
+class EngineBenchmarks {
+public:
+    //juce::dsp::Convolution is far heavier than the player convolvers, more would only
+    //make the run long
+    static constexpr int maxConvolutionProcessors = 16;
+
+    EngineBenchmarks(MainContentComponent &engineToTime, BenchmarkRunner &benchmarkRunner, double rate, int block)
+        : engine(engineToTime), runner(benchmarkRunner), sampleRate(rate), blockSize(block),
+          input(1, block), scratch(2, block), bus(2, block) {
+        Random random(0x5eed);
+        for (int i = 0; i < blockSize; ++i)
+            input.setSample(0, i, random.nextFloat() * 2.0f - 1.0f);
+    }
+
+    /*=================================================================================*/
+
+    void runBlockBenchmarks(const std::vector<int> &sourceCounts) {
+        for (auto numSources : sourceCounts) {
+            if (runner.isWanted("BinauralConvolver"))
+                binauralConvolver(numSources);
+            if (runner.isWanted("FirConvolver"))
+                firConvolver(numSources);
+            if (runner.isWanted("ConvolutionProcessor") && numSources <= maxConvolutionProcessors)
+                convolutionProcessor(numSources);
+            if (runner.isWanted("mixLoop"))
+                mixLoop(numSources);
+            if (runner.isWanted("applyGain"))
+                applyGain(numSources);
+            if (runner.isWanted("followRoute"))
+                followRoute(numSources);
+            if (runner.isWanted("RouteSpline::getPosition"))
+                routePosition(numSources);
+            if (runner.isWanted("HrtfIndex::findNearest"))
+                findNearest(numSources);
+            if (runner.isWanted("HrtfIndex::findRingNeighbours"))
+                findRingNeighbours(numSources);
+            if (runner.isWanted("HrtfSphere::getGains"))
+                sphereGains(numSources);
+            if (numSources <= MainContentComponent::maxPlayers) {
+                if (runner.isWanted("getNextAudioBlock FFT"))
+                    sceneBlock("getNextAudioBlock FFT", MainContentComponent::backendFFT, numSources);
+                if (runner.isWanted("getNextAudioBlock FIR"))
+                    sceneBlock("getNextAudioBlock FIR", MainContentComponent::backendFIR, numSources);
+            }
+        }
+    }
+
+    //Leaves the engine's HRIR set rebuilt from the WAVs, so run these last on an engine
+    void runLoadBenchmarks() {
+        if (runner.isWanted("buildHrirGrid"))
+            buildHrirGrid();
+        if (runner.isWanted("HrirGrid::interpolate"))
+            interpolateFromGrid();
+    }
+
+private:
+    //Every source starts at its own angle and turns once a second
+    std::vector<float> getStartAzimuths(int numSources) const {
+        std::vector<float> azimuths;
+        for (int i = 0; i < numSources; ++i)
+            azimuths.push_back(std::fmod(137.5f * i, 360.0f));
+        return azimuths;
+    }
+
+    float advance(float azimuth, int numSamples) const {
+        return std::fmod(azimuth + 360.0f * (float) (numSamples / sampleRate), 360.0f);
+    }
+
+    //Times a block of every source, each sub-block rendered into scratch by render and summed
+    //into the bus, with the ring neighbours of the source's azimuth looked up first
+    template <typename RenderSource>
+    void runPerSource(const String &name, int numSources, int interval, RenderSource &&render) {
+        auto azimuths = getStartAzimuths(numSources);
+        runner.run({name, sampleRate, blockSize, numSources}, [&] {
+            bus.clear();
+            for (int source = 0; source < numSources; ++source) {
+                for (int done = 0; done < blockSize;) {
+                    const int num = jmin(blockSize - done, interval);
+                    int indices[3];
+                    float weights[3];
+                    const int count = engine.planeIndex.findRingNeighbours(azimuths[(size_t) source], indices, weights);
+                    render(source, indices, weights, count, done, num);
+                    for (int channel = 0; channel < 2; ++channel)
+                        bus.addFrom(channel, done, scratch, channel, 0, num);
+                    azimuths[(size_t) source] = advance(azimuths[(size_t) source], num);
+                    done += num;
+                }
+            }
+        });
+    }
+
+    /*=================================================================================*/
+
+    void binauralConvolver(int numSources) {
+        std::vector<std::unique_ptr<BinauralConvolver>> convolvers;
+        for (int i = 0; i < numSources; ++i) {
+            convolvers.emplace_back(new BinauralConvolver());
+            convolvers.back()->prepare(engine.hrtfBank, true);
+        }
+
+        const int interval = jmax(engine.controlInterval, engine.hrtfBank.getPartitionSize());
+        runPerSource("BinauralConvolver", numSources, interval,
+                     [&](int source, const int *indices, const float *weights, int count, int done, int num) {
+            auto &convolver = *convolvers[(size_t) source];
+            convolver.setHrtfBlend(indices, weights, count);
+            const float *mono = input.getReadPointer(0, done);
+            convolver.process(mono, mono, scratch.getWritePointer(0), scratch.getWritePointer(1), num);
+        });
+    }
+
+    void firConvolver(int numSources) {
+        std::vector<std::unique_ptr<FirConvolver>> convolvers;
+        for (int i = 0; i < numSources; ++i) {
+            convolvers.emplace_back(new FirConvolver());
+            convolvers.back()->prepare(engine.hrirTapBank, blockSize);
+        }
+
+        runPerSource("FirConvolver", numSources, engine.controlInterval,
+                     [&](int source, const int *indices, const float *weights, int count, int done, int num) {
+            auto &convolver = *convolvers[(size_t) source];
+            convolver.setHrtfBlend(indices, weights, count);
+            convolver.process(input.getReadPointer(0, done), scratch.getWritePointer(0), scratch.getWritePointer(1), num);
+        });
+    }
+
+    //One processor per source, each on its own zero plane HRIR as the old renderer used them
+    void convolutionProcessor(int numSources) {
+        std::vector<std::unique_ptr<ConvolutionProcessor>> processors;
+        for (int i = 0; i < numSources; ++i) {
+            auto &hrtf = engine.zeroPlane[(size_t) (i * 7) % engine.zeroPlane.size()];
+            processors.emplace_back(new ConvolutionProcessor());
+            processors.back()->irBufferLeft.makeCopyOf(hrtf.hrtfL);
+            processors.back()->irBufferRight.makeCopyOf(hrtf.hrtfR);
+            processors.back()->prepareToPlay(sampleRate, blockSize);
+        }
+        for (auto &processor : processors) {
+            if (!waitForImpulseResponse(*processor)) {
+                std::cout << "ConvolutionProcessor: impulse response not loaded, " << numSources << " sources skipped\n";
+                return;
+            }
+        }
+
+        AudioSampleBuffer stereo(2, blockSize);
+        MidiBuffer midi;
+        runner.run({"ConvolutionProcessor", sampleRate, blockSize, numSources}, [&] {
+            bus.clear();
+            for (auto &processor : processors) {
+                stereo.copyFrom(0, 0, input, 0, 0, blockSize);
+                stereo.copyFrom(1, 0, input, 0, 0, blockSize);
+                processor->processBlock(stereo, midi);
+                for (int channel = 0; channel < 2; ++channel)
+                    bus.addFrom(channel, 0, stereo, channel, 0, blockSize);
+            }
+        });
+    }
+
+    //juce::dsp::Convolution swaps a new impulse response in from a background thread and then
+    //crossfades to it. An impulse is fed until the response is wet, not silent and the same twice
+    //in a row, so the timing never starts on the dry pass-through. False if that has not happened
+    //within 5 s.
+    bool waitForImpulseResponse(ConvolutionProcessor &processor) {
+        AudioSampleBuffer probe(2, blockSize), previous(2, blockSize);
+        MidiBuffer midi;
+        previous.clear();
+
+        for (int attempt = 0; attempt < 500; ++attempt) {
+            probe.clear();
+            for (int channel = 0; channel < 2; ++channel)
+                probe.setSample(channel, 0, 1.0f);
+            processor.reset();
+            processor.processBlock(probe, midi);
+
+            float fromDry = 0, fromPrevious = 0;
+            for (int channel = 0; channel < 2; ++channel) {
+                for (int i = 0; i < blockSize; ++i) {
+                    const float sample = probe.getSample(channel, i);
+                    fromDry = jmax(fromDry, std::abs(sample - (i == 0 ? 1.0f : 0.0f)));
+                    fromPrevious = jmax(fromPrevious, std::abs(sample - previous.getSample(channel, i)));
+                }
+            }
+            if (fromDry > 1.0e-3f && fromPrevious < 1.0e-6f && probe.getMagnitude(0, blockSize) > 0.0f)
+                return true;
+
+            previous.makeCopyOf(probe);
+            Thread::sleep(10);
+        }
+        return false;
+    }
+
+    /*=================================================================================*/
+
+    //Stems as long as half a second, placeSound's stems only differ in length
+    void mixLoop(int numSources) {
+        const int length = jmax(blockSize * 4, (int) (sampleRate / 2));
+        Random random(numSources);
+        std::vector<AudioPlayer> stems((size_t) numSources);
+        for (auto &stem : stems) {
+            stem.convolvedBuffer.setSize(2, length);
+            for (int channel = 0; channel < 2; ++channel)
+                for (int i = 0; i < length; ++i)
+                    stem.convolvedBuffer.setSample(channel, i, random.nextFloat() * 0.1f);
+            stem.playHead = random.nextInt(length);
+        }
+
+        AudioSourceChannelInfo info(&bus, 0, blockSize);
+        runner.run({"mixLoop", sampleRate, blockSize, numSources}, [&] {
+            bus.clear();
+            for (auto &stem : stems)
+                engine.mixLoop(info, stem, 1.0f);
+        });
+    }
+
+    void applyGain(int numSources) {
+        for (int channel = 0; channel < 2; ++channel)
+            bus.copyFrom(channel, 0, input, 0, 0, blockSize);
+
+        AudioSourceChannelInfo info(&bus, 0, blockSize);
+        runner.run({"applyGain", sampleRate, blockSize, numSources}, [&] {
+            for (int i = 0; i < numSources; ++i)
+                engine.applyGain(&info, 0.999);
+        });
+    }
+
+    //Per control interval as renderPlayers calls it: every source moves, then the placement
+    //pass runs over all of them. Sources share the engine's players.
+    void followRoute(int numSources) {
+        const int numPlayers = engine.sources.size();
+        if (numPlayers == 0)
+            return;
+
+        runner.run({"followRoute", sampleRate, blockSize, numSources}, [&] {
+            for (int done = 0; done < blockSize; done += engine.controlInterval) {
+                const int num = jmin(engine.controlInterval, blockSize - done);
+                for (int source = 0; source < numSources; ++source)
+                    engine.followRoute(source % numPlayers, num);
+                engine.sources.updateDirections(jmin(numSources, numPlayers));
+                engine.sources.updateHrtfHandles(jmin(numSources, numPlayers), engine.planeIndex);
+            }
+        });
+    }
+
+    //The spline alone, without the HRTF lookup placePlayer does. Sources spread over the lap.
+    void routePosition(int numSources) {
+        auto route = engine.playerRoute;
+        if (route == nullptr)
+            return;
+
+        double seconds = 0;
+        runner.run({"RouteSpline::getPosition", sampleRate, blockSize, numSources}, [&] {
+            float sum = 0;
+            for (int source = 0; source < numSources; ++source)
+                for (int done = 0; done < blockSize; done += engine.controlInterval)
+                    sum += route->getPosition(seconds + source * 0.37 + done / sampleRate).x;
+            seconds += blockSize / sampleRate;
+            lookupSink += (int) sum;
+        });
+    }
+
+    /*=================================================================================*/
+
+    //The lookups run per control interval, the results are summed so none is optimised away
+    template <typename Lookup>
+    void runLookup(const String &name, int numSources, Lookup &&lookup) {
+        auto azimuths = getStartAzimuths(numSources);
+        runner.run({name, sampleRate, blockSize, numSources}, [&] {
+            int sum = 0;
+            for (int source = 0; source < numSources; ++source) {
+                for (int done = 0; done < blockSize; done += engine.controlInterval) {
+                    sum += lookup(azimuths[(size_t) source]);
+                    azimuths[(size_t) source] = advance(azimuths[(size_t) source], engine.controlInterval);
+                }
+            }
+            lookupSink += sum;
+        });
+    }
+
+    void findNearest(int numSources) {
+        runLookup("HrtfIndex::findNearest", numSources, [this](float azimuth) {
+            return engine.planeIndex.findNearest(azimuth, 0.0f).index;
+        });
+    }
+
+    void findRingNeighbours(int numSources) {
+        runLookup("HrtfIndex::findRingNeighbours", numSources, [this](float azimuth) {
+            int indices[3] = {};
+            float weights[3];
+            return engine.planeIndex.findRingNeighbours(azimuth, indices, weights) + indices[0];
+        });
+    }
+
+    //Elevated players, 20 degrees is well off the measured planes
+    void sphereGains(int numSources) {
+        if (!engine.hrtfSphere.isBuilt())
+            return;
+        runLookup("HrtfSphere::getGains", numSources, [this](float azimuth) {
+            int indices[3] = {};
+            float weights[3];
+            return engine.hrtfSphere.getGains(azimuth, 20.0f, indices, weights) + indices[0];
+        });
+    }
+
+    /*=================================================================================*/
+
+    //The whole binaural callback, players only so the beds do not hide the per source cost
+    void sceneBlock(const String &name, int backend, int numSources) {
+        SceneParameters parameters;
+        parameters.playing = true;
+        parameters.numPlayers = numSources;
+        parameters.crowdSize = 0;
+        parameters.convolutionBackend = backend;
+        engine.setSceneParameters(parameters);
+
+        AudioSourceChannelInfo info(&bus, 0, blockSize);
+        runner.run({name, sampleRate, blockSize, numSources}, [&] {
+            bus.clear();
+            engine.getNextAudioBlock(info);
+        });
+    }
+
+    /*=================================================================================*/
+
+    //Grid, triangulation and plane interpolation from decoded WAVs, the decodes themselves
+    //run on the startup pool before it and are done once here. The last grid is kept for
+    //interpolateFromGrid.
+    void buildHrirGrid() {
+        for (auto &name : engine.prepareHrirDecodes())
+            engine.decodeHrir(name);
+
+        runner.run({"buildHrirGrid", sampleRate, 0, 1}, [&] {
+            engine.buildHrirGrid();
+        });
+        engine.decodedHrirs.clear();
+    }
+
+    //The sphere blend behind every interpolated plane HRIR
+    void interpolateFromGrid() {
+        if (engine.hrirGrid.size() == 0 || !engine.hrtfSphere.isBuilt())
+            return;
+        float left[HrirGrid::impulseLength], right[HrirGrid::impulseLength];
+        int azimuth = 0;
+        runner.run({"HrirGrid::interpolate", sampleRate, 0, 1}, [&] {
+            engine.hrirGrid.interpolate(engine.hrtfSphere, (float) azimuth, 6.0f, left, right);
+            lookupSink += (int) left[0];
+            azimuth = (azimuth + 5) % 360;
+        });
+    }
+
+    /*=================================================================================*/
+
+    MainContentComponent &engine;
+    BenchmarkRunner &runner;
+    double sampleRate;
+    int blockSize;
+    AudioSampleBuffer input;
+    AudioSampleBuffer scratch;
+    AudioSampleBuffer bus;
+    int lookupSink = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (EngineBenchmarks)
+};
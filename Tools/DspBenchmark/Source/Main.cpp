@@ -0,0 +1,84 @@
+/*
+  ==============================================================================
+
+    DSP benchmark. Times the engine's hot paths for every sample rate, block
+    size and source count and writes the results as CSV and JSON, so a DSP
+    change can be compared against an earlier run.
+
+    DspBenchmark [--quick] [--filter <name>] [--seconds 0.2] [--iterations 50]
+                 [--csv <file.csv>] [--json <file.json>]
+
+  ==============================================================================
+*/
+
+#include "EngineBenchmarks.h"
+
+//==============================================================================
+static String getOption (const StringArray& args, const String& name, const String& defaultValue)
+{
+    auto index = args.indexOf (name);
+    return index >= 0 && index + 1 < args.size() ? args[index + 1] : defaultValue;
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; ++i)
+        args.add (argv[i]);
+
+    if (args.contains ("--help"))
+    {
+        std::cout << "Usage: DspBenchmark [--quick] [--filter <name>] [--seconds 0.2] [--iterations 50]\n"
+                     "                    [--csv <file.csv>] [--json <file.json>]\n";
+        return 0;
+    }
+
+    const bool quick = args.contains ("--quick");
+    const double secondsPerCase = jmax (0.0, getOption (args, "--seconds", quick ? "0.05" : "0.2").getDoubleValue());
+    const int minIterations = jmax (1, getOption (args, "--iterations", quick ? "10" : "50").getIntValue());
+    const String csvPath = getOption (args, "--csv", {});
+    const String jsonPath = getOption (args, "--json", {});
+
+    std::vector<double> sampleRates { 44100.0, 48000.0, 96000.0 };
+    std::vector<int> blockSizes { 32, 64, 128, 256, 512, 1024, 2048 };
+    std::vector<int> sourceCounts { 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+    if (quick)
+    {
+        sampleRates = { 48000.0 };
+        blockSizes = { 64, 512 };
+        sourceCounts = { 1, 16, 64 };
+    }
+
+    //The engine is a component, so it is made and destroyed on this thread
+    ScopedJuceInitialiser_GUI juceInitialiser;
+    BenchmarkRunner runner (secondsPerCase, minIterations, getOption (args, "--filter", {}));
+
+    for (auto sampleRate : sampleRates)
+    {
+        for (auto blockSize : blockSizes)
+        {
+            MainContentComponent engine (false);
+            engine.prepareToPlay (blockSize, sampleRate);
+
+            EngineBenchmarks benchmarks (engine, runner, sampleRate, blockSize);
+            benchmarks.runBlockBenchmarks (sourceCounts);
+            if (blockSize == blockSizes.back())
+                benchmarks.runLoadBenchmarks();
+        }
+    }
+
+    if (csvPath.isNotEmpty() && ! runner.writeCsv (File::getCurrentWorkingDirectory().getChildFile (csvPath)))
+    {
+        std::cout << "Could not write " << csvPath << "\n";
+        return 1;
+    }
+    if (jsonPath.isNotEmpty() && ! runner.writeJson (File::getCurrentWorkingDirectory().getChildFile (jsonPath)))
+    {
+        std::cout << "Could not write " << jsonPath << "\n";
+        return 1;
+    }
+
+    std::cout << runner.getResults().size() << " cases\n";
+    return 0;
+}
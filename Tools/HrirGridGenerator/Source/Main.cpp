@@ -0,0 +1,92 @@
+/*
+  ==============================================================================
+
+    HRIR grid generator. Builds the interpolated HRIR grid offline and writes
+    it as an HRIR pack the app maps at startup instead of interpolating. The
+    pack is optional, without Resources/HrirGrid.uphp the app builds the same
+    grid from the subject48 WAVs and caches it.
+
+    HrirGridGenerator --input <subject folder> --output <file.uphp>
+                      [--azimuth-step 1] [--partition 512] [--threads N]
+
+  ==============================================================================
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "../../../Source/HrirGrid.h"
+#include "../../../Source/RenderCache.h"
+
+//==============================================================================
+static String getOption (const StringArray& args, const String& name, const String& defaultValue)
+{
+    auto index = args.indexOf (name);
+    return index >= 0 && index + 1 < args.size() ? args[index + 1] : defaultValue;
+}
+
+static double millisecondsSince (int64 startTicks)
+{
+    return Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks) * 1000.0;
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; ++i)
+        args.add (argv[i]);
+
+    const File input = File::getCurrentWorkingDirectory().getChildFile (getOption (args, "--input", {}));
+    const File output = File::getCurrentWorkingDirectory().getChildFile (getOption (args, "--output", "HrirGrid.uphp"));
+    const float azimuthStep = getOption (args, "--azimuth-step", "1").getFloatValue();
+    const int partitionSize = jlimit (32, 1024, nextPowerOfTwo (getOption (args, "--partition", "512").getIntValue()));
+    const int numThreads = jmax (1, getOption (args, "--threads", String (SystemStats::getNumCpus())).getIntValue());
+
+    if (! input.isDirectory() || azimuthStep <= 0.0f || azimuthStep > 90.0f)
+    {
+        std::cout << "Usage: HrirGridGenerator --input <subject folder> --output <file.uphp>\n"
+                     "       [--azimuth-step 1] [--partition 512] [--threads N]\n";
+        return 1;
+    }
+
+    AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+    ThreadPool pool (numThreads);
+    HrirGrid grid;
+    HrtfSphere sphere;
+
+    auto startTicks = Time::getHighResolutionTicks();
+    const int numColumns = grid.loadCipicSubject (input, formatManager);
+    if (numColumns == 0 || ! grid.buildSphere (sphere))
+    {
+        std::cout << "No usable CIPIC subject in " << input.getFullPathName() << "\n";
+        return 1;
+    }
+    std::cout << "Measured: " << grid.size() << " directions from " << numColumns << " lateral angles, "
+              << sphere.getNumTriangles() << " triangles, " << String (millisecondsSince (startTicks), 1) << " ms\n";
+
+    startTicks = Time::getHighResolutionTicks();
+    const int numMeasured = grid.size();
+    grid.addPlanes (sphere, azimuthStep, pool);
+    std::cout << "Interpolated: " << grid.size() - numMeasured << " directions every " << azimuthStep << " degrees on "
+              << numThreads << " threads, " << String (millisecondsSince (startTicks), 1) << " ms\n";
+
+    //The key records what the grid came from, the app maps a shipped grid whatever its key
+    RenderCache::Key key;
+    key.add ((int) HrirPack::formatVersion).add ((double) azimuthStep).add (MinimumPhaseHrirSet::defaultLength)
+       .add ((double) HrirDecomposition::onsetThreshold);
+    auto sources = input.findChildFiles (File::findFiles, false, "*.wav");
+    sources.sort();
+    for (auto& file : sources)
+        key.add (file);
+
+    startTicks = Time::getHighResolutionTicks();
+    if (! HrirPack::write (output, key.getValue(), partitionSize, HrirGrid::impulseLength,
+                           MinimumPhaseHrirSet::defaultLength, grid.getSources()))
+    {
+        std::cout << "Could not write " << output.getFullPathName() << "\n";
+        return 1;
+    }
+    std::cout << "Packed: " << output.getFullPathName() << ", " << output.getSize() / 1024 << " KB, partition "
+              << partitionSize << ", " << String (millisecondsSince (startTicks), 1) << " ms\n";
+    return 0;
+}
@@ -0,0 +1,178 @@
+/*
+  ==============================================================================
+
+    Scene renderer. Renders scene files to binaural WAVs without an audio
+    device, faster than real time, spreading scenes and time segments over
+    a pool of threads.
+
+    SceneRenderer [--output <folder>] [--jobs N] [--segments N]
+                  [--preroll <seconds>] scene.json [scene.json ...]
+
+  ==============================================================================
+*/
+
+#include "OfflineRenderer.h"
+
+//==============================================================================
+static String getOption (const StringArray& args, const String& name, const String& defaultValue)
+{
+    auto index = args.indexOf (name);
+    return index >= 0 && index + 1 < args.size() ? args[index + 1] : defaultValue;
+}
+
+static double secondsSince (int64 startTicks)
+{
+    return Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+}
+
+//==============================================================================
+struct SceneOutput
+{
+    OfflineScene scene;
+    AudioSampleBuffer buffer;
+    std::atomic<int> segmentsLeft { 0 };
+    std::atomic<int64> startTicks { std::numeric_limits<int64>::max() };
+    double seconds = 0;
+};
+
+struct Segment
+{
+    SceneOutput* output;
+    float* channels[2];
+    int64 start;
+    int64 end;
+    std::unique_ptr<OfflineRenderer> renderer;
+};
+
+static bool writeWav (const SceneOutput& output, const File& file)
+{
+    file.deleteFile();
+    std::unique_ptr<FileOutputStream> stream (file.createOutputStream());
+    if (stream == nullptr)
+        return false;
+
+    WavAudioFormat wav;
+    std::unique_ptr<AudioFormatWriter> writer (wav.createWriterFor (stream.get(), output.scene.sampleRate, 2, 24, {}, 0));
+    if (writer == nullptr)
+        return false;
+
+    stream.release();
+    return writer->writeFromAudioSampleBuffer (output.buffer, 0, output.buffer.getNumSamples());
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; ++i)
+        args.add (argv[i]);
+
+    const File outputFolder = File::getCurrentWorkingDirectory().getChildFile (getOption (args, "--output", "."));
+    const int numJobs = jmax (1, getOption (args, "--jobs", String (SystemStats::getNumCpus())).getIntValue());
+    const int segmentsPerScene = jmax (1, getOption (args, "--segments", "1").getIntValue());
+    const double prerollSeconds = jmax (0.0, getOption (args, "--preroll", "2").getDoubleValue());
+
+    StringArray sceneFiles;
+    for (int i = 0; i < args.size(); ++i)
+    {
+        if (args[i].startsWith ("--"))
+            ++i;
+        else
+            sceneFiles.add (args[i]);
+    }
+
+    if (sceneFiles.isEmpty() || outputFolder.createDirectory().failed())
+    {
+        std::cout << "Usage: SceneRenderer [--output <folder>] [--jobs N] [--segments N]\n"
+                     "                     [--preroll <seconds>] scene.json [scene.json ...]\n";
+        return 1;
+    }
+
+    //The engine is a component, so the renderers are made and destroyed on this thread
+    ScopedJuceInitialiser_GUI juceInitialiser;
+
+    std::vector<std::unique_ptr<SceneOutput>> outputs;
+    for (auto& path : sceneFiles)
+    {
+        outputs.emplace_back (new SceneOutput());
+        auto result = OfflineScene::load (File::getCurrentWorkingDirectory().getChildFile (path), outputs.back()->scene);
+        if (result.failed())
+        {
+            std::cout << result.getErrorMessage() << "\n";
+            return 1;
+        }
+    }
+
+    //Segments start on the scene's block grid, so joined spans match one long render
+    std::vector<Segment> segments;
+    for (auto& output : outputs)
+    {
+        auto& scene = output->scene;
+        output->buffer.setSize (2, (int) scene.numSamples);
+        output->buffer.clear();
+
+        const int64 numBlocks = (scene.numSamples + scene.blockSize - 1) / scene.blockSize;
+        const int numSegments = (int) jmin ((int64) segmentsPerScene, numBlocks);
+        output->segmentsLeft = numSegments;
+        for (int i = 0; i < numSegments; ++i)
+        {
+            const int64 start = numBlocks * i / numSegments * scene.blockSize;
+            const int64 end = jmin (scene.numSamples, numBlocks * (i + 1) / numSegments * scene.blockSize);
+            //Raw pointers, the buffer itself is never touched while segments run
+            auto* const* channels = output->buffer.getArrayOfWritePointers();
+            segments.push_back ({ output.get(), { channels[0] + start, channels[1] + start }, start, end,
+                                  std::make_unique<OfflineRenderer> (scene) });
+        }
+    }
+
+    const auto totalTicks = Time::getHighResolutionTicks();
+    {
+        ThreadPool pool (numJobs);
+        std::atomic<int> remaining { (int) segments.size() };
+        WaitableEvent finished;
+
+        for (auto& segment : segments)
+        {
+            pool.addJob ([&segment, &remaining, &finished, prerollSeconds]
+            {
+                auto& output = *segment.output;
+                auto startTicks = output.startTicks.load();
+                const auto now = Time::getHighResolutionTicks();
+                while (now < startTicks && ! output.startTicks.compare_exchange_weak (startTicks, now)) {}
+
+                segment.renderer->prepare();
+                const auto preroll = (int64) (prerollSeconds * output.scene.sampleRate);
+                segment.renderer->render (segment.start, segment.end, preroll, segment.channels);
+
+                if (--output.segmentsLeft == 0)
+                    output.seconds = secondsSince (output.startTicks);
+                if (--remaining == 0)
+                    finished.signal();
+            });
+        }
+        finished.wait();
+    }
+    const double totalSeconds = secondsSince (totalTicks);
+    segments.clear();
+
+    //Wall clock from a scene's first segment starting to its last finishing
+    double audioSeconds = 0;
+    for (auto& output : outputs)
+    {
+        const auto file = outputFolder.getChildFile (File::createLegalFileName (output->scene.name) + ".wav");
+        const double duration = (double) output->scene.numSamples / output->scene.sampleRate;
+        audioSeconds += duration;
+
+        if (! writeWav (*output, file))
+            std::cout << "Could not write " << file.getFullPathName() << "\n";
+        else
+            std::cout << output->scene.name << ": " << String (duration, 1) << " s in " << String (output->seconds, 2)
+                      << " s, " << String (duration / jmax (1.0e-9, output->seconds), 1) << "x real time -> "
+                      << file.getFullPathName() << "\n";
+    }
+
+    std::cout << outputs.size() << " scenes, " << String (audioSeconds, 1) << " s of audio in " << String (totalSeconds, 2)
+              << " s on " << numJobs << " threads, " << String (audioSeconds / jmax (1.0e-9, totalSeconds), 1)
+              << "x real time\n";
+    return 0;
+}
@@ -0,0 +1,257 @@
+/*==============================================================================
+//                      Offline Renderer
+//      Renders a scene file through the app's engine without an audio device
+//==============================================================================
+// - A scene is a JSON file: render settings, the starting SceneParameters,
+//   player routes as timed positions and timed parameter or player events.
+// - The engine is a MainContentComponent made without an audio device, fed
+//   through the same snapshot and command queue the GUI uses, one block at a
+//   time and as fast as the CPU allows.
+// - A render can cover any span of the scene. Everything before it is skipped
+//   without convolving, then a preroll is rendered and dropped so convolver
+//   history and crossfades are settled when the span starts. Spans of one
+//   scene can therefore be rendered on different cores and joined.
+*/
+
+#pragma once
+
+#include "../../../Source/MainComponent.h"
+
+//==============================================================================
+//              Offline Scene
+//
+//==============================================================================
+
+struct OfflineScene {
+    struct RoutePoint {
+        int64 sample;
+        float x;
+        float y;
+    };
+
+    struct Route {
+        int player;
+        std::vector<RoutePoint> points;
+    };
+
+    //Either a SceneParameters field by name or a SceneCommand
+    struct Event {
+        int64 sample;
+        String parameter;
+        double value;
+        bool isCommand;
+        SceneCommand command;
+    };
+
+    String name;
+    double sampleRate = 48000.0;
+    int blockSize = 512;
+    int64 numSamples = 0;
+    File hrirPack;
+    SceneParameters parameters;
+    std::vector<Route> routes;
+    std::vector<Event> events;
+
+    /*=================================================================================*/
+
+    //Relative paths in the scene are resolved against its folder
+    static Result load(const File &file, OfflineScene &scene) {
+        var root;
+        auto parsed = JSON::parse(file.loadFileAsString(), root);
+        if (parsed.failed())
+            return parsed;
+        if (!root.isObject())
+            return Result::fail(file.getFileName() + " is not a JSON object");
+
+        scene = OfflineScene();
+        scene.name = root.getProperty("name", file.getFileNameWithoutExtension()).toString();
+        scene.sampleRate = root.getProperty("sampleRate", scene.sampleRate);
+        scene.blockSize = root.getProperty("blockSize", scene.blockSize);
+        scene.numSamples = (int64) ((double) root.getProperty("seconds", 10.0) * scene.sampleRate);
+        if (scene.sampleRate <= 0 || scene.blockSize <= 0 || scene.numSamples <= 0)
+            return Result::fail(file.getFileName() + ": sampleRate, blockSize and seconds must be positive");
+
+        if (root.hasProperty("hrirPack"))
+            scene.hrirPack = file.getParentDirectory().getChildFile(root["hrirPack"].toString());
+
+        scene.parameters.playing = true;
+        if (auto *initial = root["scene"].getDynamicObject())
+            for (auto &property : initial->getProperties())
+                if (!setParameter(scene.parameters, property.name.toString(), property.value))
+                    return Result::fail(file.getFileName() + ": unknown scene parameter " + property.name.toString());
+
+        if (auto *routes = root["routes"].getArray()) {
+            for (auto &route : *routes) {
+                Route parsedRoute { (int) route["player"], {} };
+                if (auto *points = route["points"].getArray())
+                    for (auto &point : *points)
+                        parsedRoute.points.push_back({scene.toSamples(point[0]), (float) point[1], (float) point[2]});
+                std::sort(parsedRoute.points.begin(), parsedRoute.points.end(),
+                          [](const RoutePoint &a, const RoutePoint &b) { return a.sample < b.sample; });
+                if (!parsedRoute.points.empty())
+                    scene.routes.push_back(parsedRoute);
+            }
+        }
+
+        if (auto *events = root["events"].getArray()) {
+            for (auto &event : *events) {
+                Event parsedEvent { scene.toSamples(event["time"]), {}, 0.0, false, {} };
+                if (event.hasProperty("command")) {
+                    if (!parseCommand(event, parsedEvent.command))
+                        return Result::fail(file.getFileName() + ": unknown command " + event["command"].toString());
+                    parsedEvent.isCommand = true;
+                } else {
+                    SceneParameters check;
+                    parsedEvent.parameter = event["set"].toString();
+                    parsedEvent.value = event["value"];
+                    if (!setParameter(check, parsedEvent.parameter, parsedEvent.value))
+                        return Result::fail(file.getFileName() + ": unknown scene parameter " + parsedEvent.parameter);
+                }
+                scene.events.push_back(parsedEvent);
+            }
+        }
+        std::stable_sort(scene.events.begin(), scene.events.end(),
+                         [](const Event &a, const Event &b) { return a.sample < b.sample; });
+        return Result::ok();
+    }
+
+    /*=================================================================================*/
+
+    static bool setParameter(SceneParameters &parameters, const String &name, const var &value) {
+        if (name == "playing")
+            parameters.playing = (bool) value;
+        else if (name == "players")
+            parameters.numPlayers = (int) value;
+        else if (name == "crowdSize")
+            parameters.crowdSize = (double) value;
+        else if (name == "renderMode")
+            parameters.renderMode = (int) value;
+        else if (name == "backend")
+            parameters.convolutionBackend = (int) value;
+        else if (name == "minimumPhase")
+            parameters.minimumPhase = (bool) value;
+        else if (name == "controlInterval")
+            parameters.controlInterval = jmax(1, (int) value);
+        else
+            return false;
+        return true;
+    }
+
+private:
+    int64 toSamples(const var &seconds) const { return (int64) ((double) seconds * sampleRate); }
+
+    static bool parseCommand(const var &event, SceneCommand &command) {
+        const auto type = event["command"].toString();
+        if (type == "setPlayerPosition")
+            command.type = SceneCommand::setPlayerPosition;
+        else if (type == "releasePlayer")
+            command.type = SceneCommand::releasePlayer;
+        else if (type == "setPlayerTrim")
+            command.type = SceneCommand::setPlayerTrim;
+        else if (type == "setPlayerElevation")
+            command.type = SceneCommand::setPlayerElevation;
+        else
+            return false;
+
+        command.player = event["player"];
+        command.x = event.getProperty("x", 0.0f);
+        command.y = event.getProperty("y", 0.0f);
+        command.value = event.getProperty("value", 1.0f);
+        return true;
+    }
+};
+
+//==============================================================================
+//              Offline Renderer
+//
+//==============================================================================
+
+class OfflineRenderer {
+public:
+    //Message thread, the engine is a component. Everything else may run on any one thread.
+    explicit OfflineRenderer(const OfflineScene &sceneToRender) : scene(sceneToRender), engine(false) {}
+
+    /*=================================================================================*/
+
+    //Loads the HRIR set, banks and clips. Not real-time safe, call once before render.
+    void prepare() {
+        engine.setHrirPack(scene.hrirPack);
+        engine.prepareToPlay(scene.blockSize, scene.sampleRate);
+    }
+
+    //Renders samples start to end of the scene into the two output channels, sample start
+    //first. Blocks keep the scene's block grid, so a span renders the same blocks a full
+    //render would.
+    void render(int64 start, int64 end, int64 preroll, float *const *output) {
+        const int64 renderFrom = jmax((int64) 0, start - preroll) / scene.blockSize * scene.blockSize;
+        AudioSampleBuffer block(2, scene.blockSize);
+        SceneParameters parameters = scene.parameters;
+        engine.setSceneParameters(parameters);
+        size_t nextEvent = 0;
+
+        for (int64 position = 0; position < end; position += scene.blockSize) {
+            const int num = (int) jmin((int64) scene.blockSize, end - position);
+
+            //Everything due by the block start goes in before it, positions are where the
+            //route puts each player at the block's end
+            bool parametersChanged = false;
+            for (; nextEvent < scene.events.size() && scene.events[nextEvent].sample <= position; ++nextEvent) {
+                auto &event = scene.events[nextEvent];
+                if (event.isCommand)
+                    engine.postCommand(event.command);
+                else
+                    parametersChanged |= OfflineScene::setParameter(parameters, event.parameter, event.value);
+            }
+            if (parametersChanged)
+                engine.setSceneParameters(parameters);
+            for (auto &route : scene.routes)
+                engine.postCommand(getRouteCommand(route, position + num));
+
+            if (position + num <= renderFrom) {
+                engine.skipScene(num);
+                continue;
+            }
+
+            block.clear();
+            AudioSourceChannelInfo info(&block, 0, num);
+            engine.getNextAudioBlock(info);
+
+            const int64 copyFrom = jmax(position, start);
+            const int64 copyTo = position + num;
+            for (int channel = 0; channel < 2 && copyFrom < copyTo; ++channel)
+                FloatVectorOperations::copy(output[channel] + (copyFrom - start),
+                                            block.getReadPointer(channel, (int) (copyFrom - position)),
+                                            (int) (copyTo - copyFrom));
+        }
+    }
+
+private:
+    //Linear between the route's points, held at either end
+    static SceneCommand getRouteCommand(const OfflineScene::Route &route, int64 sample) {
+        SceneCommand command;
+        command.type = SceneCommand::setPlayerPosition;
+        command.player = route.player;
+
+        auto next = std::find_if(route.points.begin(), route.points.end(),
+                                 [sample](const OfflineScene::RoutePoint &point) { return point.sample > sample; });
+        if (next == route.points.begin() || next == route.points.end()) {
+            auto &point = next == route.points.begin() ? route.points.front() : route.points.back();
+            command.x = point.x;
+            command.y = point.y;
+            return command;
+        }
+
+        auto &from = *(next - 1);
+        const float t = (float) (sample - from.sample) / (float) (next->sample - from.sample);
+        command.x = from.x + (next->x - from.x) * t;
+        command.y = from.y + (next->y - from.y) * t;
+        return command;
+    }
+
+    /*=================================================================================*/
+
+    const OfflineScene &scene;
+    MainContentComponent engine;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OfflineRenderer)
+};